@@ -0,0 +1,418 @@
+#ifndef ALLREDUCE_H
+#define ALLREDUCE_H
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cerrno>
+#include <cstring>
+
+// POSIX sockets, shared memory and polling
+#include <unistd.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Link between a ring rank and its two neighbours. Transports are created
+// before the workers are forked, then each worker attaches to its own rank.
+class RingTransport
+{
+public:
+    virtual ~RingTransport(){}
+
+    // Called in each worker after fork, keeps only the links for this rank
+    virtual void attach(unsigned int rank) = 0;
+
+    // Send to the next rank whilst receiving from the previous rank
+    virtual void exchange(const double* send_buf, unsigned int send_count,
+                          double* recv_buf, unsigned int recv_count) = 0;
+
+    // Wake any peers blocked on this worker, used when a worker fails
+    virtual void abort(){}
+};
+
+// Shared implementation for stream sockets (Unix-domain and TCP)
+class SocketRingTransport : public RingTransport
+{
+protected:
+    unsigned int m_world_size;
+
+    // Socket to the next rank (send) and previous rank (receive)
+    int m_next_fd = -1;
+    int m_prev_fd = -1;
+
+    static void _close_fd(int& fd)
+    {
+        if(fd >= 0)
+        {
+            ::close(fd);
+        }
+        fd = -1;
+    }
+
+public:
+    explicit SocketRingTransport(unsigned int world_size) : m_world_size(world_size){}
+
+    ~SocketRingTransport()
+    {
+        _close_fd(m_next_fd);
+        _close_fd(m_prev_fd);
+    }
+
+    void exchange(const double* send_buf, unsigned int send_count,
+                  double* recv_buf, unsigned int recv_count)
+    {
+        const char* out = reinterpret_cast<const char*>(send_buf);
+        char* in = reinterpret_cast<char*>(recv_buf);
+        size_t send_total = send_count * sizeof(double);
+        size_t recv_total = recv_count * sizeof(double);
+        size_t sent = 0;
+        size_t received = 0;
+
+        // Both directions are serviced together, otherwise every rank could
+        // block in send() once the socket buffers are full
+        while(sent < send_total || received < recv_total)
+        {
+            pollfd fds[2];
+            fds[0].fd = (sent < send_total) ? m_next_fd : -1;
+            fds[0].events = POLLOUT;
+            fds[0].revents = 0;
+            fds[1].fd = (received < recv_total) ? m_prev_fd : -1;
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+
+            if(::poll(fds, 2, -1) < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::string("all-reduce poll failed: ") + std::strerror(errno);
+            }
+
+            if(fds[0].revents != 0)
+            {
+                ssize_t n = ::send(m_next_fd, out + sent, send_total - sent,
+                                   MSG_DONTWAIT | MSG_NOSIGNAL);
+                if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    throw std::string("all-reduce send failed: ") + std::strerror(errno);
+                }
+                sent += (n > 0) ? n : 0;
+            }
+
+            if(fds[1].revents != 0)
+            {
+                ssize_t n = ::recv(m_prev_fd, in + received, recv_total - received, MSG_DONTWAIT);
+                if(n == 0)
+                {
+                    throw std::string("all-reduce peer closed the connection");
+                }
+                if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    throw std::string("all-reduce recv failed: ") + std::strerror(errno);
+                }
+                received += (n > 0) ? n : 0;
+            }
+        }
+    }
+
+    void abort()
+    {
+        _close_fd(m_next_fd);
+        _close_fd(m_prev_fd);
+    }
+};
+
+// Unix-domain socket pairs, one per ring link
+class UnixSocketTransport : public SocketRingTransport
+{
+private:
+    // Link i connects rank i (element 0) to rank i+1 (element 1)
+    std::vector<std::pair<int, int>> m_links;
+
+public:
+    explicit UnixSocketTransport(unsigned int world_size) : SocketRingTransport(world_size)
+    {
+        for(unsigned int i = 0; i < world_size; i++)
+        {
+            int fds[2];
+            if(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            {
+                throw std::string("unable to create socket pair: ") + std::strerror(errno);
+            }
+            m_links.push_back(std::make_pair(fds[0], fds[1]));
+        }
+    }
+
+    ~UnixSocketTransport()
+    {
+        for(auto&& link: m_links)
+        {
+            _close_fd(link.first);
+            _close_fd(link.second);
+        }
+    }
+
+    void attach(unsigned int rank)
+    {
+        unsigned int prev = (rank + m_world_size - 1) % m_world_size;
+        m_next_fd = m_links[rank].first;
+        m_prev_fd = m_links[prev].second;
+        m_links[rank].first = -1;
+        m_links[prev].second = -1;
+
+        // Drop the links belonging to the other ranks
+        for(auto&& link: m_links)
+        {
+            _close_fd(link.first);
+            _close_fd(link.second);
+        }
+    }
+};
+
+// TCP sockets on the loopback interface, one listener per rank
+class TcpSocketTransport : public SocketRingTransport
+{
+private:
+    std::vector<int> m_listeners;
+    std::vector<unsigned short> m_ports;
+
+public:
+    explicit TcpSocketTransport(unsigned int world_size) : SocketRingTransport(world_size)
+    {
+        for(unsigned int i = 0; i < world_size; i++)
+        {
+            int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = 0;
+            socklen_t len = sizeof(addr);
+            if(fd < 0 ||
+               ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+               ::listen(fd, 1) != 0 ||
+               ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+            {
+                throw std::string("unable to open loopback listener: ") + std::strerror(errno);
+            }
+            m_listeners.push_back(fd);
+            m_ports.push_back(ntohs(addr.sin_port));
+        }
+    }
+
+    ~TcpSocketTransport()
+    {
+        for(auto&& fd: m_listeners)
+        {
+            _close_fd(fd);
+        }
+    }
+
+    void attach(unsigned int rank)
+    {
+        // Connect first: the successor's backlog accepts it without blocking
+        m_next_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(m_ports[(rank + 1) % m_world_size]);
+        if(m_next_fd < 0 ||
+           ::connect(m_next_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+        {
+            throw std::string("unable to connect to next rank: ") + std::strerror(errno);
+        }
+
+        m_prev_fd = ::accept(m_listeners[rank], nullptr, nullptr);
+        if(m_prev_fd < 0)
+        {
+            throw std::string("unable to accept previous rank: ") + std::strerror(errno);
+        }
+
+        int flag = 1;
+        ::setsockopt(m_next_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        ::setsockopt(m_prev_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+        for(auto&& fd: m_listeners)
+        {
+            _close_fd(fd);
+        }
+    }
+};
+
+// Single-slot mailboxes in an anonymous shared mapping, inherited over fork
+class SharedMemoryTransport : public RingTransport
+{
+private:
+    struct Mailbox
+    {
+        std::atomic<unsigned int> full;
+        unsigned int count;
+    };
+
+    unsigned int m_world_size;
+    unsigned int m_capacity;
+    size_t m_stride;
+    size_t m_length;
+    char* m_region = nullptr;
+    std::atomic<unsigned int>* m_aborted = nullptr;
+    unsigned int m_rank = 0;
+
+    Mailbox* _mailbox(unsigned int i)
+    {
+        return reinterpret_cast<Mailbox*>(m_region + m_stride * (i + 1));
+    }
+
+    double* _payload(unsigned int i)
+    {
+        return reinterpret_cast<double*>(m_region + m_stride * (i + 1) + 64);
+    }
+
+    void _wait_for(Mailbox* box, unsigned int state)
+    {
+        while(box->full.load(std::memory_order_acquire) != state)
+        {
+            if(m_aborted->load(std::memory_order_relaxed) != 0)
+            {
+                throw std::string("all-reduce aborted by another worker");
+            }
+            sched_yield();
+        }
+    }
+
+public:
+    // Capacity is the largest message, in doubles, sent over any link
+    explicit SharedMemoryTransport(unsigned int world_size, unsigned int capacity)
+        : m_world_size(world_size), m_capacity(capacity)
+    {
+        // Keep each mailbox on its own cache lines
+        m_stride = ((64 + capacity * sizeof(double)) + 63) / 64 * 64;
+        m_length = m_stride * (world_size + 1);
+        void* region = ::mmap(nullptr, m_length, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if(region == MAP_FAILED)
+        {
+            throw std::string("unable to map shared memory: ") + std::strerror(errno);
+        }
+        m_region = static_cast<char*>(region);
+        m_aborted = new (m_region) std::atomic<unsigned int>(0);
+        for(unsigned int i = 0; i < world_size; i++)
+        {
+            Mailbox* box = new (_mailbox(i)) Mailbox();
+            box->full.store(0);
+            box->count = 0;
+        }
+    }
+
+    ~SharedMemoryTransport()
+    {
+        if(m_region != nullptr)
+        {
+            ::munmap(m_region, m_length);
+        }
+    }
+
+    void attach(unsigned int rank)
+    {
+        m_rank = rank;
+    }
+
+    void exchange(const double* send_buf, unsigned int send_count,
+                  double* recv_buf, unsigned int recv_count)
+    {
+        if(send_count > m_capacity || recv_count > m_capacity)
+        {
+            throw std::string("all-reduce message exceeds shared memory capacity");
+        }
+
+        // Mailbox i is written by rank i and read by rank i+1
+        Mailbox* out = _mailbox(m_rank);
+        _wait_for(out, 0);
+        std::memcpy(_payload(m_rank), send_buf, send_count * sizeof(double));
+        out->count = send_count;
+        out->full.store(1, std::memory_order_release);
+
+        unsigned int prev = (m_rank + m_world_size - 1) % m_world_size;
+        Mailbox* in = _mailbox(prev);
+        _wait_for(in, 1);
+        if(in->count != recv_count)
+        {
+            throw std::string("all-reduce received an unexpected message size");
+        }
+        std::memcpy(recv_buf, _payload(prev), recv_count * sizeof(double));
+        in->full.store(0, std::memory_order_release);
+    }
+
+    void abort()
+    {
+        m_aborted->store(1, std::memory_order_relaxed);
+    }
+};
+
+// Bandwidth optimal ring all-reduce (reduce-scatter then all-gather)
+class RingAllReduce
+{
+private:
+    std::shared_ptr<RingTransport> m_transport;
+    unsigned int m_rank;
+    unsigned int m_world_size;
+
+    // Scratch space for the incoming chunk
+    std::vector<double> m_recv;
+
+public:
+    explicit RingAllReduce(std::shared_ptr<RingTransport> transport,
+                           unsigned int rank,
+                           unsigned int world_size)
+        : m_transport(transport), m_rank(rank), m_world_size(world_size)
+    {
+    }
+
+    // Element-wise sum over all ranks; every rank receives identical values
+    void sum(std::vector<double>& values)
+    {
+        unsigned int n = values.size();
+        unsigned int w = m_world_size;
+        if(w < 2 || n == 0)
+        {
+            return;
+        }
+
+        auto chunk_begin = [n, w](unsigned int c) { return (unsigned int)((unsigned long)c * n / w); };
+        auto chunk_size = [&chunk_begin](unsigned int c) { return chunk_begin(c + 1) - chunk_begin(c); };
+        m_recv.resize(n / w + 1);
+
+        // Reduce-scatter: after w-1 steps rank r owns the total for chunk r+1
+        for(unsigned int step = 0; step < w - 1; step++)
+        {
+            unsigned int send_chunk = (m_rank + w - step) % w;
+            unsigned int recv_chunk = (m_rank + w - step - 1) % w;
+            m_transport->exchange(&values[0] + chunk_begin(send_chunk), chunk_size(send_chunk),
+                                  &m_recv[0], chunk_size(recv_chunk));
+            double* target = &values[0] + chunk_begin(recv_chunk);
+            for(unsigned int i = 0; i < chunk_size(recv_chunk); i++)
+            {
+                target[i] += m_recv[i];
+            }
+        }
+
+        // All-gather: circulate the reduced chunks
+        for(unsigned int step = 0; step < w - 1; step++)
+        {
+            unsigned int send_chunk = (m_rank + 1 + w - step) % w;
+            unsigned int recv_chunk = (m_rank + w - step) % w;
+            m_transport->exchange(&values[0] + chunk_begin(send_chunk), chunk_size(send_chunk),
+                                  &values[0] + chunk_begin(recv_chunk), chunk_size(recv_chunk));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef ASYNC_TRAINING_H
+#define ASYNC_TRAINING_H
+
+#include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
+
+#include "gradient.h"
+#include "threadpool.h"
+
+// Handle to a training run queued on a thread pool. Keeps the optimiser alive
+// until the run has finished.
+class TrainingHandle
+{
+private:
+    std::shared_ptr<GradientDescent> m_grad;
+    std::shared_future<std::vector<double>> m_result;
+
+public:
+    explicit TrainingHandle(std::shared_ptr<GradientDescent> grad,
+                            std::shared_future<std::vector<double>> result)
+        : m_grad(grad), m_result(result){}
+
+    // Request the run stops at its next check, get() then returns the theta so far
+    void cancel()
+    {
+        m_grad->cancel();
+    }
+
+    bool ready() const
+    {
+        return m_result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // Wait up to seconds, returns whether the run has finished
+    bool wait_for(double seconds) const
+    {
+        return m_result.wait_for(std::chrono::duration<double>(seconds)) == std::future_status::ready;
+    }
+
+    // Blocks until the run finishes, rethrows anything the run threw
+    std::vector<double> get() const
+    {
+        return m_result.get();
+    }
+
+    // StopReason::running until the run finishes, safe from any thread
+    StopReason stop_reason() const
+    {
+        return m_grad->stop_reason();
+    }
+};
+
+class AsyncTraining
+{
+public:
+    // Queue grad->run() on the pool and return immediately. Set budgets and
+    // callbacks on grad before starting it.
+    static TrainingHandle start(std::shared_ptr<GradientDescent> grad, ThreadPool& pool)
+    {
+        std::shared_future<std::vector<double>> result =
+            pool.submit([grad]() { return grad->run(); }).share();
+        return TrainingHandle(grad, result);
+    }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef CONVERGENCE_H
+#define CONVERGENCE_H
+
+#include <vector>
+#include <iostream>
+#include <cmath>
+#include <memory>
+
+// input parameters
+#include "parameter.hh"
+
+// Descent settings shared by the gradient trainers, from the config when
+// given and the base values otherwise
+struct DescentSettings
+{
+    // Initial learning rate
+    double alpha = 0.01;
+
+    // Convergence delta epsilon
+    double eps = 0.00001;
+
+    // Percentage by which to adjust learning rate at each iteration
+    float adaptive_learning_rate = 0.05;
+
+    // Momentum rate
+    float momentum_gamma = 0.9;
+
+    // Print the error every N iterations
+    unsigned int print_err_modulo = 1;
+
+    explicit DescentSettings(std::shared_ptr<ConfigParameters> params = nullptr)
+    {
+        if(params == nullptr)
+        {
+            return;
+        }
+        alpha = params->get<double>("optimisation.grad.alpha");
+        eps = params->get<double>("optimisation.grad.eps");
+        adaptive_learning_rate = params->get<double>("optimisation.grad.adaptive_learning_rate");
+        if(params->has("optimisation.grad.momentum_gamma"))
+        {
+            momentum_gamma = params->get<double>("optimisation.grad.momentum_gamma");
+        }
+        if(params->has("optimisation.print_err_modulo"))
+        {
+            print_err_modulo = params->get<unsigned int>("optimisation.print_err_modulo");
+        }
+    }
+};
+
+// Stopping rule shared by the gradient trainers. A run has converged once the
+// error is below optimisation.grad.acceptable_error, or once it is below
+// optimisation.grad.theta_convergence and no parameter moved by epsilon or
+// more. The second threshold stops a run stuck in a saddle point at a high
+// error from counting as converged.
+class ConvergenceCheck
+{
+private:
+    double m_acceptable_error = 0.00001;
+    double m_theta_convergence = 0.01;
+
+public:
+    explicit ConvergenceCheck(std::shared_ptr<ConfigParameters> params = nullptr)
+    {
+        if(params != nullptr)
+        {
+            m_acceptable_error = params->get<double>("optimisation.grad.acceptable_error");
+            m_theta_convergence = params->get<double>("optimisation.grad.theta_convergence");
+        }
+    }
+
+    bool converged(const std::vector<double>& theta, const std::vector<double>& new_theta,
+                   double current_error, double epsilon, bool verbose = false) const
+    {
+        // Stop early
+        if(current_error < m_acceptable_error)
+        {
+            if(verbose)
+            {
+                std::cout << "Current error below manual acceptable threshold level." << std::endl;
+            }
+            return true;
+        }
+
+        // Stop if theta params stopped changing
+        bool can_converge = current_error < m_theta_convergence;
+        for (unsigned int i = 0; i < theta.size(); i++)
+        {
+            can_converge = can_converge && std::fabs(theta[i]-new_theta[i]) < epsilon;
+        }
+        return can_converge;
+    }
+};
+
+#endif
@@ -0,0 +1,479 @@
+#ifndef COORDINATE_DESCENT_H
+#define COORDINATE_DESCENT_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <algorithm>
+#include <thread>
+
+// input parameters
+#include "parameter.hh"
+
+// Optimisation datapoint
+#include "datapoint.h"
+
+// Reproducible sums
+#include "reduction.h"
+
+// One solution on a regularisation path
+struct RegularisationPathPoint
+{
+    double lambda;
+    std::vector<double> theta;
+    unsigned int passes;
+    unsigned int non_zero;
+    double objective;
+};
+
+// Cyclic coordinate descent for Lasso and elastic-net linear regression,
+// minimising
+//   1/(2W) sum w (y - theta . x)^2 + lambda (a |theta|_1 + (1 - a)/2 |theta|^2)
+// over the same (normalised) DataPoints as GradientDescent, where w are the
+// point weights and W their sum. Feature 0 is the intercept column and is not
+// penalised.
+//
+// When there are few features relative to rows (and at most 512) the Gram
+// matrix X'X/W and X'y/W are computed once, so each coordinate update costs
+// O(d) instead of O(N).
+//
+// Settings (all optional):
+//   optimisation.cd.alpha         a, 1 is Lasso, 0 is ridge (default 1)
+//   optimisation.cd.lambda_count  points on the path (default 100)
+//   optimisation.cd.lambda_ratio  smallest lambda / largest (default 0.001)
+//   optimisation.cd.tol           largest coordinate change to stop (default 1e-7)
+//   optimisation.cd.max_passes    passes over the coordinates per lambda (default 1000)
+//   optimisation.cd.gram          auto | on | off (default auto)
+//   optimisation.reduce.threads   threads building the Gram matrix (default 1),
+//                                 which doesn't change the result
+//
+// optimisation.features is not supported.
+class CoordinateDescent
+{
+    private:
+
+        // Largest d for which auto picks the Gram matrix (d x d doubles)
+        static const unsigned int gram_max_features = 512;
+
+        // Row chunks summed separately when building the Gram matrix
+        static const unsigned int gram_chunks = 16;
+
+        unsigned int number_of_training_points;
+        unsigned int number_of_features;
+
+        double m_alpha = 1.0;
+        unsigned int m_lambda_count = 100;
+        double m_lambda_ratio = 0.001;
+        double m_tol = 1e-7;
+        unsigned int m_max_passes = 1000;
+        bool m_use_gram = false;
+
+        // Gram mode: X'X/W (d x d, row major), X'y/W and y'y/W
+        std::vector<double> m_gram;
+        std::vector<double> m_xty;
+        double m_yty = 0.0;
+
+        // Residual mode: column major X, y, row weights and the residual y - X theta
+        std::vector<double> m_columns;
+        std::vector<double> m_targets;
+        std::vector<double> m_weights;
+        std::vector<double> m_residual;
+
+        // Sum of the row weights, N when unweighted
+        double m_total_weight = 0.0;
+
+        // X_j . X_j / W, needed in both modes
+        std::vector<double> m_column_norms;
+
+        static double _soft_threshold(double value, double threshold)
+        {
+            if(value > threshold)
+            {
+                return value - threshold;
+            }
+            if(value < -threshold)
+            {
+                return value + threshold;
+            }
+            return 0.0;
+        }
+
+        // X_j . r / W + (X_j . X_j / W) theta_j
+        double _rho(unsigned int j, const std::vector<double>& theta) const
+        {
+            if(m_use_gram)
+            {
+                const double* row = &m_gram[(size_t)j * number_of_features];
+                double sum = m_xty[j];
+                for(unsigned int k = 0; k < number_of_features; k++)
+                {
+                    sum -= row[k] * theta[k];
+                }
+                return sum + row[j] * theta[j];
+            }
+            const double* column = &m_columns[(size_t)j * number_of_training_points];
+            double sum = 0.0;
+            for(unsigned int i = 0; i < number_of_training_points; i++)
+            {
+                sum += m_weights[i] * column[i] * m_residual[i];
+            }
+            return sum / m_total_weight + m_column_norms[j] * theta[j];
+        }
+
+        // Minimise over coordinate j, returns the change
+        double _update(unsigned int j, double lambda, std::vector<double>& theta)
+        {
+            double l1 = (j == 0) ? 0.0 : lambda * m_alpha;
+            double l2 = (j == 0) ? 0.0 : lambda * (1.0 - m_alpha);
+            double denominator = m_column_norms[j] + l2;
+            if(denominator <= 0.0)
+            {
+                return 0.0;
+            }
+            double updated = _soft_threshold(this->_rho(j, theta), l1) / denominator;
+            double delta = updated - theta[j];
+            if(delta != 0.0)
+            {
+                theta[j] = updated;
+                if(!m_use_gram)
+                {
+                    const double* column = &m_columns[(size_t)j * number_of_training_points];
+                    for(unsigned int i = 0; i < number_of_training_points; i++)
+                    {
+                        m_residual[i] -= delta * column[i];
+                    }
+                }
+            }
+            return std::fabs(delta) * std::sqrt(m_column_norms[j]);
+        }
+
+        void _reset_residual(const std::vector<double>& theta)
+        {
+            if(m_use_gram)
+            {
+                return;
+            }
+            m_residual = m_targets;
+            for(unsigned int j = 0; j < number_of_features; j++)
+            {
+                const double* column = &m_columns[(size_t)j * number_of_training_points];
+                for(unsigned int i = 0; i < number_of_training_points; i++)
+                {
+                    m_residual[i] -= theta[j] * column[i];
+                }
+            }
+        }
+
+        // One pass over the given coordinates, returns the largest change
+        double _pass(const std::vector<unsigned int>& coordinates, double lambda, std::vector<double>& theta)
+        {
+            double largest = 0.0;
+            for(auto j: coordinates)
+            {
+                largest = std::max(largest, this->_update(j, lambda, theta));
+            }
+            return largest;
+        }
+
+    public:
+        explicit CoordinateDescent(std::vector<DataPoint>& data_points,
+                                   std::shared_ptr<ConfigParameters> config_params = nullptr)
+        {
+            number_of_training_points = data_points.size();
+            number_of_features = data_points.empty() ? 0 : data_points[0].getFeatures().size();
+            if(number_of_training_points == 0)
+            {
+                throw std::string("coordinate descent needs at least one data point");
+            }
+
+            if(config_params != nullptr && config_params->has("optimisation.features"))
+            {
+                throw std::string("optimisation.features is not supported by CoordinateDescent");
+            }
+
+            std::string gram = "auto";
+            unsigned int threads = 1;
+            if(config_params != nullptr)
+            {
+                if(config_params->has("optimisation.cd.alpha"))
+                {
+                    m_alpha = config_params->get<double>("optimisation.cd.alpha");
+                }
+                if(config_params->has("optimisation.cd.lambda_count"))
+                {
+                    m_lambda_count = std::max(1u, config_params->get<unsigned int>("optimisation.cd.lambda_count"));
+                }
+                if(config_params->has("optimisation.cd.lambda_ratio"))
+                {
+                    m_lambda_ratio = config_params->get<double>("optimisation.cd.lambda_ratio");
+                }
+                if(config_params->has("optimisation.cd.tol"))
+                {
+                    m_tol = config_params->get<double>("optimisation.cd.tol");
+                }
+                if(config_params->has("optimisation.cd.max_passes"))
+                {
+                    m_max_passes = config_params->get<unsigned int>("optimisation.cd.max_passes");
+                }
+                if(config_params->has("optimisation.cd.gram"))
+                {
+                    gram = config_params->getString("optimisation.cd.gram");
+                }
+                if(config_params->has("optimisation.reduce.threads"))
+                {
+                    threads = config_params->get<unsigned int>("optimisation.reduce.threads");
+                }
+            }
+            // The Gram matrix pays off once a pass over d coordinates of d terms
+            // is cheaper than one over N rows
+            m_use_gram = (gram == "on") ||
+                (gram == "auto" && number_of_features <= number_of_training_points / 4 &&
+                 number_of_features <= gram_max_features);
+
+            unsigned int d = number_of_features;
+            m_total_weight = DeterministicReduction::sum(number_of_training_points, [&data_points](size_t i)
+            {
+                return data_points[i].getWeight();
+            });
+            double n = m_total_weight;
+            m_column_norms.assign(d, 0.0);
+            if(m_use_gram)
+            {
+                // Upper triangle of X'X, then X'y and y'y, summed over a fixed
+                // number of row chunks with DeterministicReduction's kernel and
+                // combined over its tree. The chunks depend only on N, so the
+                // sums are bit identical for any thread count, and memory is
+                // gram_chunks x width whatever N.
+                unsigned int triangle = d * (d + 1) / 2;
+                unsigned int width = triangle + d + 1;
+                size_t chunk_rows = (number_of_training_points + gram_chunks - 1) / gram_chunks;
+                size_t chunks = DeterministicReduction::number_of_blocks(number_of_training_points, chunk_rows);
+                std::vector<double> partials(chunks * width);
+                auto term = [&data_points, d, triangle](size_t i, double* out)
+                {
+                    std::vector<double>& x = data_points[i].getFeatures();
+                    double y = data_points[i].getTarget(0);
+                    double w = data_points[i].getWeight();
+                    unsigned int index = 0;
+                    for(unsigned int j = 0; j < d; j++)
+                    {
+                        double wx = w * x[j];
+                        for(unsigned int k = j; k < d; k++)
+                        {
+                            out[index++] = wx * x[k];
+                        }
+                        out[triangle + j] = wx * y;
+                    }
+                    out[triangle + d] = w * y * y;
+                };
+                threads = std::max(1u, std::min<unsigned int>(threads, chunks));
+                auto accumulate = [this, &term, &partials, width, chunk_rows, chunks, threads](unsigned int t)
+                {
+                    DeterministicReduction::block_partials(number_of_training_points, width, term,
+                                                           chunks * t / threads, chunks * (t + 1) / threads,
+                                                           &partials[0], chunk_rows);
+                };
+                std::vector<std::thread> workers;
+                for(unsigned int t = 1; t < threads; t++)
+                {
+                    workers.push_back(std::thread(accumulate, t));
+                }
+                accumulate(0);
+                for(auto&& worker: workers)
+                {
+                    worker.join();
+                }
+                std::vector<double> sums;
+                DeterministicReduction::combine(&partials[0], chunks, width, sums);
+
+                m_gram.assign((size_t)d * d, 0.0);
+                m_xty.assign(d, 0.0);
+                unsigned int index = 0;
+                for(unsigned int j = 0; j < d; j++)
+                {
+                    for(unsigned int k = j; k < d; k++)
+                    {
+                        m_gram[(size_t)j * d + k] = m_gram[(size_t)k * d + j] = sums[index++] / n;
+                    }
+                    m_xty[j] = sums[triangle + j] / n;
+                    m_column_norms[j] = m_gram[(size_t)j * d + j];
+                }
+                m_yty = sums[triangle + d] / n;
+            }
+            else
+            {
+                m_columns.resize((size_t)d * number_of_training_points);
+                m_targets.resize(number_of_training_points);
+                m_weights.resize(number_of_training_points);
+                for(unsigned int i = 0; i < number_of_training_points; i++)
+                {
+                    std::vector<double>& x = data_points[i].getFeatures();
+                    double w = data_points[i].getWeight();
+                    for(unsigned int j = 0; j < d; j++)
+                    {
+                        m_columns[(size_t)j * number_of_training_points + i] = x[j];
+                        m_column_norms[j] += w * x[j] * x[j];
+                    }
+                    m_targets[i] = data_points[i].getTarget(0);
+                    m_weights[i] = w;
+                }
+                for(unsigned int j = 0; j < d; j++)
+                {
+                    m_column_norms[j] /= n;
+                }
+            }
+        }
+
+        bool uses_gram() const
+        {
+            return m_use_gram;
+        }
+
+        // Smallest lambda for which every penalised coefficient is zero
+        double lambda_max()
+        {
+            // Fit the intercept alone first
+            std::vector<double> theta(number_of_features, 0.0);
+            this->_reset_residual(theta);
+            this->_update(0, 0.0, theta);
+
+            double largest = 0.0;
+            for(unsigned int j = 1; j < number_of_features; j++)
+            {
+                largest = std::max(largest, std::fabs(this->_rho(j, theta)));
+            }
+            return largest / std::max(m_alpha, 1e-3);
+        }
+
+        // Penalised objective at theta
+        double objective(const std::vector<double>& theta, double lambda)
+        {
+            double loss = 0.0;
+            if(m_use_gram)
+            {
+                double quadratic = 0.0;
+                double linear = 0.0;
+                for(unsigned int j = 0; j < number_of_features; j++)
+                {
+                    linear += theta[j] * m_xty[j];
+                    for(unsigned int k = 0; k < number_of_features; k++)
+                    {
+                        quadratic += theta[j] * m_gram[(size_t)j * number_of_features + k] * theta[k];
+                    }
+                }
+                loss = 0.5 * (m_yty - 2.0 * linear + quadratic);
+            }
+            else
+            {
+                for(unsigned int i = 0; i < number_of_training_points; i++)
+                {
+                    loss += m_weights[i] * m_residual[i] * m_residual[i];
+                }
+                loss /= 2.0 * m_total_weight;
+            }
+            double l1 = 0.0;
+            double l2 = 0.0;
+            for(unsigned int j = 1; j < number_of_features; j++)
+            {
+                l1 += std::fabs(theta[j]);
+                l2 += theta[j] * theta[j];
+            }
+            return loss + lambda * (m_alpha * l1 + 0.5 * (1.0 - m_alpha) * l2);
+        }
+
+        // Solve for one lambda from a warm start. Full passes find the active
+        // set, then passes over only the non-zero coefficients converge it; it
+        // finishes when a full pass changes nothing.
+        std::vector<double> fit(double lambda, std::vector<double> theta, unsigned int* passes = nullptr)
+        {
+            theta.resize(number_of_features, 0.0);
+            this->_reset_residual(theta);
+
+            std::vector<unsigned int> all(number_of_features);
+            for(unsigned int j = 0; j < number_of_features; j++)
+            {
+                all[j] = j;
+            }
+
+            unsigned int number_of_passes = 0;
+            while(number_of_passes < m_max_passes)
+            {
+                double change = this->_pass(all, lambda, theta);
+                number_of_passes++;
+                if(change < m_tol)
+                {
+                    break;
+                }
+
+                std::vector<unsigned int> active;
+                for(unsigned int j = 0; j < number_of_features; j++)
+                {
+                    if(j == 0 || theta[j] != 0.0)
+                    {
+                        active.push_back(j);
+                    }
+                }
+                while(number_of_passes < m_max_passes)
+                {
+                    change = this->_pass(active, lambda, theta);
+                    number_of_passes++;
+                    if(change < m_tol)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            if(passes != nullptr)
+            {
+                *passes = number_of_passes;
+            }
+            return theta;
+        }
+
+        // Geometric lambda path from lambda_max down, each fit warm started
+        // from the previous solution
+        std::vector<RegularisationPathPoint> path()
+        {
+            auto start = std::chrono::steady_clock::now();
+            double largest = this->lambda_max();
+            double smallest = largest * m_lambda_ratio;
+
+            // No feature correlates with the residual, the path is just lambda 0
+            unsigned int lambda_count = (largest > 0.0) ? m_lambda_count : 1;
+
+            std::vector<RegularisationPathPoint> points;
+            std::vector<double> theta(number_of_features, 0.0);
+            unsigned long total_passes = 0;
+            for(unsigned int k = 0; k < lambda_count; k++)
+            {
+                double lambda = (lambda_count == 1) ? largest :
+                    largest * std::pow(smallest / largest, (double)k / (lambda_count - 1));
+
+                RegularisationPathPoint point;
+                point.lambda = lambda;
+                point.theta = this->fit(lambda, theta, &point.passes);
+                point.non_zero = 0;
+                for(unsigned int j = 1; j < number_of_features; j++)
+                {
+                    point.non_zero += (point.theta[j] != 0.0);
+                }
+                point.objective = this->objective(point.theta, lambda);
+                theta = point.theta;
+                total_passes += point.passes;
+                points.push_back(point);
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Coordinate descent path: " << lambda_count << " lambdas, "
+                      << total_passes << " passes, " << seconds << "s ("
+                      << (m_use_gram ? "gram" : "residual") << " updates)" << std::endl;
+            return points;
+        }
+};
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef CROSS_VALIDATION_H
+#define CROSS_VALIDATION_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <random>
+#include <utility>
+#include <memory>
+#include <future>
+#include <algorithm>
+#include <exception>
+
+// input parameters
+#include "parameter.hh"
+
+// Optimisation datapoint
+#include "datapoint.h"
+#include "normalisation.h"
+#include "linearerrorfunction.h"
+
+// Reproducible sums
+#include "reduction.h"
+
+// Line searches and schedules, budgets
+#include "stepsize.h"
+#include "trainingcontrol.h"
+#include "convergence.h"
+
+// Folds run concurrently
+#include "threadpool.h"
+
+// Results of training on every fold but one and testing on that one
+struct FoldMetrics
+{
+    unsigned int fold;
+    size_t training_rows;
+    size_t validation_rows;
+    std::vector<double> theta;
+    std::pair<double, double> minMaxPair;
+
+    // Final training loss, on the fold's normalised scale as the trainers print it
+    double training_error;
+
+    // Validation errors in the original target units
+    double validation_mse;
+    double validation_rmse;
+    double validation_mae;
+
+    unsigned int iterations;
+    StopReason stop_reason;
+    double seconds;
+};
+
+struct CrossValidationResult
+{
+    std::vector<FoldMetrics> folds;
+    double mean_validation_mse;
+    double mean_validation_rmse;
+    double stddev_validation_rmse;
+    double mean_validation_mae;
+    double seconds;
+};
+
+// k-fold cross-validation of the linear model over one shared dataset.
+//
+// The raw (un-normalised) rows are never copied: folds are ranges of one
+// shuffled index permutation, each fold takes its min/ max from its own
+// training rows, and rows are normalised on the fly inside the loss and
+// gradient pass. The folds train concurrently on a ThreadPool with full batch
+// descent, using the same step settings as GradientDescent in batch mode.
+//
+// Settings:
+//   optimisation.cv.folds    number of folds (default 5)
+//   optimisation.cv.threads  folds trained at once, 0 for one per core (default 0)
+//   optimisation.cv.seed     shuffle seed (default 1)
+class CrossValidation
+{
+    private:
+
+        // Shared, read only during run()
+        std::vector<DataPoint>& m_data_points;
+        std::vector<double> m_initial_theta;
+        std::shared_ptr<ConfigParameters> m_config_params = nullptr;
+
+        unsigned int number_of_training_points;
+        unsigned int number_of_features;
+
+        unsigned int m_folds = 5;
+        unsigned int m_threads = 0;
+
+        // Fold f validates on m_permutation[m_fold_begin[f], m_fold_begin[f + 1])
+        std::vector<unsigned int> m_permutation;
+        std::vector<size_t> m_fold_begin;
+
+        std::shared_ptr<CancellationToken> m_token = std::make_shared<CancellationToken>();
+
+        // Row of the i-th training point of a fold, skipping its validation range
+        unsigned int _training_row(size_t i, size_t begin, size_t end) const
+        {
+            return m_permutation[i < begin ? i : i + (end - begin)];
+        }
+
+        // As Normalisation::getMinMaxFromAllData, over the fold's training rows
+        std::pair<double, double> _fold_min_max(size_t begin, size_t end) const
+        {
+            std::pair<double, double> min_max(std::numeric_limits<double>::max(),
+                                              std::numeric_limits<double>::lowest());
+            size_t rows = number_of_training_points - (end - begin);
+            for(size_t i = 0; i < rows; i++)
+            {
+                DataPoint& data_point = m_data_points[this->_training_row(i, begin, end)];
+                for(auto target: data_point.getTargets())
+                {
+                    min_max = Normalisation::getMinMaxFromTrainingExample(target, min_max.first, min_max.second);
+                }
+                for(auto feature: data_point.getFeatures())
+                {
+                    min_max = Normalisation::getMinMaxFromTrainingExample(feature, min_max.first, min_max.second);
+                }
+            }
+
+            // Don't use the edge of the scales, as they may include 0s
+            return std::make_pair(min_max.first - 1, min_max.second + 1);
+        }
+
+        FoldMetrics _run_fold(unsigned int fold)
+        {
+            auto start = std::chrono::steady_clock::now();
+            size_t begin = m_fold_begin[fold];
+            size_t end = m_fold_begin[fold + 1];
+
+            FoldMetrics metrics;
+            metrics.fold = fold;
+            metrics.validation_rows = end - begin;
+            metrics.training_rows = number_of_training_points - metrics.validation_rows;
+            metrics.minMaxPair = this->_fold_min_max(begin, end);
+            double min = metrics.minMaxPair.first;
+            double max = metrics.minMaxPair.second;
+
+            DescentSettings settings(m_config_params);
+            ConvergenceCheck convergence(m_config_params);
+
+            // Same sums as LinearErrorFunction::error_and_gradient on a
+            // normalised copy of the training rows. The fold runs on one
+            // thread, so one scratch row will do.
+            unsigned int d = number_of_features;
+            size_t training_rows = metrics.training_rows;
+            std::vector<double> row(d);
+            BatchEvaluation evaluate = [this, d, training_rows, begin, end, min, max, &row]
+                (const std::vector<double>& theta, std::vector<double>& gradient)
+            {
+                std::vector<double> sums;
+                DeterministicReduction::sum_vector(training_rows, d + 1, [&](size_t i, double* out)
+                {
+                    DataPoint& data_point = m_data_points[this->_training_row(i, begin, end)];
+                    std::vector<double>& features = data_point.getFeatures();
+                    for(unsigned int j = 0; j < d; j++)
+                    {
+                        row[j] = Normalisation::normaliseDataPoint(features[j], max, min);
+                    }
+                    LinearErrorFunction::row_terms(&row[0], d, &theta[0],
+                                                   Normalisation::normaliseDataPoint(data_point.getTarget(0), max, min),
+                                                   data_point.getWeight(), out);
+                }, sums, 1);
+                gradient.assign(sums.begin(), sums.begin() + d);
+                return sums[d] / 2.0;
+            };
+
+            std::shared_ptr<BatchStepSize> step_size =
+                StepSizeFactory::make_batch_step(m_config_params, settings.alpha, settings.adaptive_learning_rate);
+            TrainingControl control;
+            control.add_params(m_config_params);
+            control.set_cancellation_token(m_token);
+            control.start();
+
+            std::vector<double> theta(d, 1.0);
+            for(unsigned int i = 0; i < m_initial_theta.size() && i < d; i++)
+            {
+                theta[i] = m_initial_theta[i];
+            }
+            std::vector<double> gradient;
+            double current_error = evaluate(theta, gradient);
+            bool converge = false;
+            unsigned int number_of_iterations = 0;
+            while (!converge && !control.should_stop(number_of_iterations))
+            {
+                std::vector<double> newTheta;
+                std::vector<double> new_gradient;
+                double new_error;
+                step_size->step(theta, gradient, current_error, evaluate,
+                                newTheta, new_gradient, new_error);
+                if(step_size->stalled())
+                {
+                    control.stalled();
+                    break;
+                }
+
+                converge = convergence.converged(theta, newTheta, new_error, settings.eps);
+
+                theta = newTheta;
+                gradient = new_gradient;
+                current_error = new_error;
+                number_of_iterations++;
+            }
+            if(converge)
+            {
+                control.converged();
+            }
+
+            // Weighted validation errors in the original units
+            double squared = 0.0;
+            double absolute = 0.0;
+            double total_weight = 0.0;
+            for(size_t i = begin; i < end; i++)
+            {
+                DataPoint& data_point = m_data_points[m_permutation[i]];
+                std::vector<double>& features = data_point.getFeatures();
+                double h_theta = 0.0;
+                for(unsigned int j = 0; j < d; j++)
+                {
+                    h_theta += theta[j]*Normalisation::normaliseDataPoint(features[j], max, min);
+                }
+                double difference = Normalisation::denormaliseDataPoint(h_theta, max, min) - data_point.getTarget(0);
+                squared += data_point.getWeight() * difference * difference;
+                absolute += data_point.getWeight() * std::fabs(difference);
+                total_weight += data_point.getWeight();
+            }
+            double validation_rows = (total_weight > 0.0) ? total_weight : 1.0;
+
+            metrics.theta = theta;
+            metrics.training_error = current_error;
+            metrics.validation_mse = squared / validation_rows;
+            metrics.validation_rmse = std::sqrt(metrics.validation_mse);
+            metrics.validation_mae = absolute / validation_rows;
+            metrics.iterations = number_of_iterations;
+            metrics.stop_reason = control.stop_reason();
+            metrics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return metrics;
+        }
+
+    public:
+        // data_point_samples are the raw rows, with the intercept column, and
+        // must outlive the CrossValidation
+        explicit CrossValidation(std::vector<DataPoint>& data_point_samples,
+                                 std::vector<double>& initial_theta,
+                                 std::shared_ptr<ConfigParameters> config_params = nullptr)
+            : m_data_points(data_point_samples),
+              m_initial_theta(initial_theta),
+              m_config_params(config_params)
+        {
+            if(config_params != nullptr && config_params->has("optimisation.features"))
+            {
+                throw std::string("optimisation.features is not supported by CrossValidation");
+            }
+
+            unsigned int seed = 1;
+            if(config_params != nullptr)
+            {
+                if(config_params->has("optimisation.cv.folds"))
+                {
+                    m_folds = config_params->get<unsigned int>("optimisation.cv.folds");
+                }
+                if(config_params->has("optimisation.cv.threads"))
+                {
+                    m_threads = config_params->get<unsigned int>("optimisation.cv.threads");
+                }
+                if(config_params->has("optimisation.cv.seed"))
+                {
+                    seed = config_params->get<unsigned int>("optimisation.cv.seed");
+                }
+            }
+
+            number_of_training_points = data_point_samples.size();
+            number_of_features = number_of_training_points > 0 ? data_point_samples[0].getFeatures().size() : 0;
+            if(m_folds < 2 || m_folds > number_of_training_points)
+            {
+                throw "cross-validation needs between 2 and " + std::to_string(number_of_training_points) +
+                    " folds, got " + std::to_string(m_folds);
+            }
+
+            m_permutation.resize(number_of_training_points);
+            for(unsigned int i = 0; i < number_of_training_points; i++)
+            {
+                m_permutation[i] = i;
+            }
+            std::mt19937 shuffle(seed);
+            std::shuffle(m_permutation.begin(), m_permutation.end(), shuffle);
+
+            for(unsigned int f = 0; f <= m_folds; f++)
+            {
+                m_fold_begin.push_back((size_t)number_of_training_points * f / m_folds);
+            }
+        }
+
+        // Stops every fold at its next iteration, safe to call from any thread
+        void cancel()
+        {
+            m_token->cancel();
+        }
+
+        // Trains the folds on a pool of optimisation.cv.threads threads
+        CrossValidationResult run()
+        {
+            unsigned int threads = (m_threads != 0) ? m_threads : std::max(1u, std::thread::hardware_concurrency());
+            ThreadPool pool(std::min(threads, m_folds));
+            return this->run(pool);
+        }
+
+        // Trains the folds on a shared pool
+        CrossValidationResult run(ThreadPool& pool)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::future<FoldMetrics>> pending;
+            for(unsigned int f = 0; f < m_folds; f++)
+            {
+                pending.push_back(pool.submit([this, f]() { return this->_run_fold(f); }));
+            }
+
+            // Every fold must finish before this returns, as the tasks use
+            // this, so a failure is only rethrown once all are done
+            CrossValidationResult result;
+            std::exception_ptr failure;
+            for(auto&& fold: pending)
+            {
+                try
+                {
+                    result.folds.push_back(fold.get());
+                }
+                catch(...)
+                {
+                    if(!failure)
+                    {
+                        failure = std::current_exception();
+                    }
+                }
+            }
+            if(failure)
+            {
+                std::rethrow_exception(failure);
+            }
+
+            double mse = 0.0, rmse = 0.0, mae = 0.0;
+            for(auto&& fold: result.folds)
+            {
+                mse += fold.validation_mse;
+                rmse += fold.validation_rmse;
+                mae += fold.validation_mae;
+            }
+            result.mean_validation_mse = mse / m_folds;
+            result.mean_validation_rmse = rmse / m_folds;
+            result.mean_validation_mae = mae / m_folds;
+            double variance = 0.0;
+            for(auto&& fold: result.folds)
+            {
+                double difference = fold.validation_rmse - result.mean_validation_rmse;
+                variance += difference * difference;
+            }
+            result.stddev_validation_rmse = std::sqrt(variance / (m_folds - 1));
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return result;
+        }
+
+        static void print_report(const CrossValidationResult& result)
+        {
+            std::streamsize precision = std::cout.precision(6);
+            for(auto&& fold: result.folds)
+            {
+                std::cout << "Fold " << fold.fold << ": " << fold.training_rows << " training, "
+                          << fold.validation_rows << " validation rows, RMSE " << fold.validation_rmse
+                          << ", MAE " << fold.validation_mae << ", " << fold.iterations << " iterations ("
+                          << to_string(fold.stop_reason) << "), " << fold.seconds << "s" << std::endl;
+            }
+            std::cout << "Cross-validation: RMSE " << result.mean_validation_rmse << " +/- "
+                      << result.stddev_validation_rmse << ", MSE " << result.mean_validation_mse
+                      << ", MAE " << result.mean_validation_mae << ", " << result.seconds << "s" << std::endl;
+            std::cout.precision(precision);
+        }
+};
+
+#endif
@@ -11,12 +11,16 @@ class DataPoint
         std::vector<double> features;
         std::vector<double> targets;
 
+        // Multiplies this point's term in the error, e.g. a duplicate count
+        double weight;
+
     public:
         
-        DataPoint(std::vector<double>& feat, std::vector<double>& tar)
+        DataPoint(std::vector<double>& feat, std::vector<double>& tar, double w = 1.0)
         {
             features = feat;
             targets = tar;
+            weight = w;
         }
 
         // Get feature i
@@ -54,6 +58,18 @@ class DataPoint
         {
             return targets;
         }
+
+        // Get the weight
+        double getWeight() const
+        {
+            return weight;
+        }
+
+        // Set the weight
+        void setWeight(double w)
+        {
+            weight = w;
+        }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+#ifndef DEDUPLICATION_H
+#define DEDUPLICATION_H
+
+#include <vector>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// Optimisation datapoint
+#include "datapoint.h"
+
+// Collapses exact duplicate rows into one weighted row at load time. As the
+// error and gradient scale each row by its weight, the batch loss and
+// gradient are those of the original data, with less memory and per-epoch
+// work. The stochastic pass takes one weighted step per distinct row rather
+// than one step per copy.
+class Deduplication
+{
+private:
+
+    static uint64_t _mix(uint64_t hash, uint64_t value)
+    {
+        // splitmix64 finaliser over the running hash
+        hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+        hash ^= hash >> 30;
+        hash *= 0xbf58476d1ce4e5b9ull;
+        hash ^= hash >> 27;
+        hash *= 0x94d049bb133111ebull;
+        hash ^= hash >> 31;
+        return hash;
+    }
+
+    static uint64_t _hash_values(uint64_t hash, const std::vector<double>& values)
+    {
+        hash = _mix(hash, values.size());
+        for(auto value: values)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            hash = _mix(hash, bits);
+        }
+        return hash;
+    }
+
+    static bool _same_values(const std::vector<double>& a, const std::vector<double>& b)
+    {
+        return a.size() == b.size() &&
+               (a.empty() || std::memcmp(&a[0], &b[0], a.size() * sizeof(double)) == 0);
+    }
+
+public:
+
+    // Hash of the bit patterns of the features and targets
+    static uint64_t hash(DataPoint& data_point)
+    {
+        return _hash_values(_hash_values(0, data_point.getFeatures()), data_point.getTargets());
+    }
+
+    // Bit identical features and targets (so 0.0 and -0.0 differ)
+    static bool same_row(DataPoint& a, DataPoint& b)
+    {
+        return _same_values(a.getFeatures(), b.getFeatures()) &&
+               _same_values(a.getTargets(), b.getTargets());
+    }
+
+    // Replaces each group of identical rows with its first occurrence, weighted
+    // by the sum of the group's weights, keeping the order of first
+    // occurrences. Rows are hashed and grouped on threads (0 for one per
+    // core). Returns the number of rows removed.
+    static size_t collapse(std::vector<DataPoint>& rows, unsigned int threads = 0)
+    {
+        size_t n = rows.size();
+        if(threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = std::max<unsigned int>(1, std::min<size_t>(threads, n / 4096 + 1));
+
+        // Hash slices of the rows, sorting the indices into one list per
+        // shard (hash % threads). Lists stay in ascending index order.
+        std::vector<uint64_t> hashes(n);
+        std::vector<std::vector<std::vector<size_t>>> shard_lists(threads,
+            std::vector<std::vector<size_t>>(threads));
+        auto hash_slice = [&rows, &hashes, &shard_lists, n, threads](unsigned int t)
+        {
+            for(size_t i = n * t / threads; i < n * (t + 1) / threads; i++)
+            {
+                hashes[i] = hash(rows[i]);
+                shard_lists[t][hashes[i] % threads].push_back(i);
+            }
+        };
+
+        // Each shard groups its rows, adding the weight of every duplicate to
+        // the first occurrence
+        std::vector<double> weights(n);
+        std::vector<char> keep(n, 1);
+        auto group_shard = [&rows, &hashes, &shard_lists, &weights, &keep, threads](unsigned int s)
+        {
+            std::unordered_map<uint64_t, std::vector<size_t>> first_occurrences;
+            for(unsigned int t = 0; t < threads; t++)
+            {
+                for(auto i: shard_lists[t][s])
+                {
+                    weights[i] = rows[i].getWeight();
+                    std::vector<size_t>& candidates = first_occurrences[hashes[i]];
+                    bool duplicate = false;
+                    for(auto first: candidates)
+                    {
+                        if(same_row(rows[first], rows[i]))
+                        {
+                            weights[first] += weights[i];
+                            keep[i] = 0;
+                            duplicate = true;
+                            break;
+                        }
+                    }
+                    if(!duplicate)
+                    {
+                        candidates.push_back(i);
+                    }
+                }
+            }
+        };
+
+        for(auto phase: {0, 1})
+        {
+            std::vector<std::thread> workers;
+            for(unsigned int t = 1; t < threads; t++)
+            {
+                workers.push_back(std::thread([&, phase, t]()
+                {
+                    (phase == 0) ? hash_slice(t) : group_shard(t);
+                }));
+            }
+            (phase == 0) ? hash_slice(0) : group_shard(0);
+            for(auto&& worker: workers)
+            {
+                worker.join();
+            }
+        }
+
+        // Compact in place
+        size_t kept = 0;
+        for(size_t i = 0; i < n; i++)
+        {
+            if(keep[i])
+            {
+                if(kept != i)
+                {
+                    rows[kept] = std::move(rows[i]);
+                }
+                rows[kept].setWeight(weights[i]);
+                kept++;
+            }
+        }
+        rows.erase(rows.begin() + kept, rows.end());
+        rows.shrink_to_fit();
+        return n - kept;
+    }
+};
+
+#endif
@@ -0,0 +1,521 @@
+#ifndef DISTRIBUTED_GRADIENT_H
+#define DISTRIBUTED_GRADIENT_H
+
+// std::setprecision
+#include <iomanip>
+#include <limits>
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include <memory>
+#include <exception>
+
+// fork/ waitpid
+#include <csignal>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// input parameters
+#include "parameter.hh"
+
+// Optimisation datapoint
+#include "datapoint.h"
+#include "linearerrorfunction.h"
+
+// Ring all-reduce and transports
+#include "allreduce.h"
+
+// Reproducible block sums, line searches and schedules
+#include "reduction.h"
+#include "stepsize.h"
+
+// Shared descent settings and stopping rule
+#include "convergence.h"
+
+// Data-parallel batch gradient descent over several worker processes on one
+// host. Each worker owns a contiguous shard of the data and the gradients are
+// combined with a ring all-reduce.
+//
+// Modes (optimisation.dist.mode):
+//   sync    - block sums are reduced at every pass, so all replicas of theta
+//             stay identical and the run matches GradientDescent with
+//             optimisation.grad.mode:batch and the same optimisation.grad.step.
+//             Shards are subtrees of the reduction's pairwise tree over 1024
+//             row blocks, so smaller data leaves some workers idle
+//   bounded - workers step on their own shard and average theta every
+//             optimisation.dist.max_staleness + 1 iterations, so no replica is
+//             more than max_staleness updates away from the consensus
+class DistributedGradientDescent
+{
+    private:
+
+        // Internal storage of the theta variables
+        std::vector<double> m_theta;
+
+        // Internal storage of the training examples
+        std::vector<DataPoint> m_data_points;
+
+        // Store the config params, if available
+        std::shared_ptr<ConfigParameters> m_config_params = nullptr;
+
+        // Error function
+        std::shared_ptr<ErrorFunction> m_err_func;
+
+        unsigned int number_of_training_points;
+        unsigned int number_of_features;
+
+        // Distributed settings
+        unsigned int m_workers;
+        std::string m_transport;
+        bool m_bounded;
+        unsigned int m_max_staleness;
+
+        std::shared_ptr<RingTransport> _make_transport()
+        {
+            if(m_transport == "unix")
+            {
+                return std::make_shared<UnixSocketTransport>(m_workers);
+            }
+            if(m_transport == "tcp")
+            {
+                return std::make_shared<TcpSocketTransport>(m_workers);
+            }
+            if(m_transport == "shm")
+            {
+                // Largest chunk is the buffer split over the ring: (d + 1) values
+                // when bounded, (d + 1) per subtree root when sync
+                size_t values = number_of_features + 1;
+                if(!m_bounded)
+                {
+                    values *= _subtrees().size();
+                }
+                unsigned int capacity = values / m_workers + 1;
+                return std::make_shared<SharedMemoryTransport>(m_workers, capacity);
+            }
+            throw std::string("unknown transport: " + m_transport);
+        }
+
+        // Time spent by this rank in its passes and in the all-reduce
+        double m_compute_seconds = 0.0;
+        double m_reduce_seconds = 0.0;
+
+        // Rank 0's report of the last run
+        unsigned int m_iterations = 0;
+        double m_mean_compute_seconds = 0.0;
+        double m_mean_reduce_seconds = 0.0;
+        double m_seconds = 0.0;
+
+        // Depth of the reduction tree's roots that sync mode shares out, about
+        // eight per worker so the shards stay balanced
+        unsigned int _tree_levels() const
+        {
+            unsigned int levels = 3;
+            while((1u << (levels - 3)) < m_workers)
+            {
+                levels++;
+            }
+            return levels;
+        }
+
+        std::vector<std::pair<size_t, size_t>> _subtrees() const
+        {
+            size_t blocks = DeterministicReduction::number_of_blocks(number_of_training_points);
+            return DeterministicReduction::subtrees(blocks, _tree_levels());
+        }
+
+        // Full batch descent over the ranks' subtrees of the reduction tree.
+        // Each block's sums are the error function's over that block alone,
+        // i.e. the DeterministicReduction block partials. A rank combines its
+        // subtrees locally and only the subtree roots are all-reduced, then
+        // combined over the top of the same tree, so the loss, gradient and
+        // steps match GradientDescent in batch mode exactly.
+        unsigned int _run_sync(RingAllReduce& all_reduce, unsigned int rank, bool verbose,
+                               unsigned int max_iterations)
+        {
+            typedef std::chrono::steady_clock clock;
+
+            // Contiguous subtrees per rank, one vector of rows per block
+            std::vector<std::pair<size_t, size_t>> roots = _subtrees();
+            size_t blocks = DeterministicReduction::number_of_blocks(number_of_training_points);
+            unsigned int levels = _tree_levels();
+            size_t first_root = roots.size() * rank / m_workers;
+            size_t last_root = roots.size() * (rank + 1) / m_workers;
+            size_t block_size = DeterministicReduction::block_size;
+            std::vector<std::vector<std::vector<DataPoint>>> shard;
+            for(size_t r = first_root; r < last_root; r++)
+            {
+                shard.push_back(std::vector<std::vector<DataPoint>>());
+                for(size_t block = roots[r].first; block < roots[r].second; block++)
+                {
+                    size_t end = std::min<size_t>((block + 1) * block_size, number_of_training_points);
+                    shard.back().push_back(std::vector<DataPoint>(m_data_points.begin() + block * block_size,
+                                                                  m_data_points.begin() + end));
+                }
+            }
+            std::vector<DataPoint>().swap(m_data_points);
+
+            unsigned int width = number_of_features + 1;
+            std::vector<double> values(roots.size() * width);
+            std::shared_ptr<ErrorFunction> err_func = this->m_err_func;
+            BatchEvaluation evaluate = [this, err_func, &all_reduce, &shard, &values, first_root, blocks, levels, width]
+                (const std::vector<double>& theta, std::vector<double>& gradient)
+            {
+                auto compute_start = clock::now();
+                std::fill(values.begin(), values.end(), 0.0);
+                std::vector<double> at = theta;
+                std::vector<double> block_gradient;
+                std::vector<double> partials;
+                std::vector<double> root_value;
+                for(size_t r = 0; r < shard.size(); r++)
+                {
+                    partials.assign(shard[r].size() * width, 0.0);
+                    for(size_t b = 0; b < shard[r].size(); b++)
+                    {
+                        double block_error = err_func->error_and_gradient(at, shard[r][b], block_gradient);
+                        double* out = &partials[b * width];
+                        std::copy(block_gradient.begin(), block_gradient.end(), out);
+                        out[width - 1] = block_error * 2.0;
+                    }
+                    DeterministicReduction::combine(&partials[0], shard[r].size(), width, root_value);
+                    std::copy(root_value.begin(), root_value.end(), &values[(first_root + r) * width]);
+                }
+                auto reduce_start = clock::now();
+                m_compute_seconds += std::chrono::duration<double>(reduce_start - compute_start).count();
+
+                // A root has one non-zero contributor, so the sum is an exact gather
+                all_reduce.sum(values);
+                m_reduce_seconds += std::chrono::duration<double>(clock::now() - reduce_start).count();
+
+                std::vector<double> sums;
+                DeterministicReduction::combine_subtrees(values.empty() ? nullptr : &values[0], blocks, levels,
+                                                         width, sums);
+                gradient.assign(sums.begin(), sums.begin() + (width - 1));
+                return sums[width - 1] / 2.0;
+            };
+
+            DescentSettings settings(m_config_params);
+            ConvergenceCheck convergence(m_config_params);
+            std::shared_ptr<BatchStepSize> step_size =
+                StepSizeFactory::make_batch_step(m_config_params, settings.alpha, settings.adaptive_learning_rate);
+
+            // Every rank sees the same reduced values, so all take the same
+            // decisions and make the same number of passes
+            std::vector<double> gradient;
+            double current_error = evaluate(m_theta, gradient);
+            bool converge = false;
+            unsigned int number_of_iterations = 0;
+            while (!converge && number_of_iterations < max_iterations)
+            {
+                if(verbose && number_of_iterations % settings.print_err_modulo == 0)
+                {
+                    int precision = std::numeric_limits<double>::max_digits10;
+                    std::cout << std::setprecision(precision) << "Error is: " << current_error << std::endl;
+                }
+
+                std::vector<double> newTheta;
+                std::vector<double> new_gradient;
+                double new_error;
+                step_size->step(m_theta, gradient, current_error, evaluate,
+                                newTheta, new_gradient, new_error);
+                if(step_size->stalled())
+                {
+                    if(verbose)
+                    {
+                        std::cout << "Warning: line search found no decrease, stopping." << std::endl;
+                    }
+                    break;
+                }
+
+                converge = convergence.converged(m_theta, newTheta, new_error, settings.eps, verbose);
+
+                m_theta = newTheta;
+                gradient = new_gradient;
+                current_error = new_error;
+                number_of_iterations++;
+            }
+            return number_of_iterations;
+        }
+
+        // Momentum steps on the rank's own rows, averaging theta every
+        // max_staleness + 1 iterations
+        unsigned int _run_bounded(RingAllReduce& all_reduce, unsigned int rank, bool verbose,
+                                  unsigned int max_iterations)
+        {
+            typedef std::chrono::steady_clock clock;
+
+            // Keep only this rank's shard
+            unsigned int first = (unsigned long)rank * number_of_training_points / m_workers;
+            unsigned int last = (unsigned long)(rank + 1) * number_of_training_points / m_workers;
+            std::vector<DataPoint> shard(m_data_points.begin() + first, m_data_points.begin() + last);
+            std::vector<DataPoint>().swap(m_data_points);
+
+            DescentSettings settings(m_config_params);
+            ConvergenceCheck convergence(m_config_params);
+            double alpha = settings.alpha;
+
+            double previous_error = std::numeric_limits<double>::max();
+            std::vector<double> velocity(number_of_features, 0.0);
+            std::vector<double> local_theta = m_theta;
+            std::vector<double> reduce_buffer(number_of_features + 1, 0.0);
+
+            unsigned int number_of_iterations = 0;
+            unsigned int sync_period = m_max_staleness + 1;
+            bool converge = false;
+
+            while (!converge && number_of_iterations < max_iterations)
+            {
+                auto compute_start = clock::now();
+
+                // Sum of the per example derivatives over the shard
+                std::vector<double> gradient(number_of_features, 0.0);
+                for (unsigned int i = 0; i < shard.size(); i++)
+                {
+                    auto all_j_theta_derivs = this->m_err_func->error_function_derivative(shard[i], local_theta);
+                    for (unsigned int j = 0; j < number_of_features; j++)
+                    {
+                        gradient[j] += all_j_theta_derivs[j];
+                    }
+                }
+                double local_error = this->m_err_func->error_function(local_theta, shard);
+
+                // Momentum update on the shard's gradient
+                double scale = 1.0 / (shard.empty() ? 1 : shard.size());
+                for (unsigned int j = 0; j < number_of_features; j++)
+                {
+                    velocity[j] = settings.momentum_gamma * velocity[j] + alpha * gradient[j] * scale;
+                    local_theta[j] -= velocity[j];
+                }
+                m_compute_seconds += std::chrono::duration<double>(clock::now() - compute_start).count();
+
+                if((number_of_iterations + 1) % sync_period == 0)
+                {
+                    // Average the replicas, the error is that of the replicas at
+                    // the start of this iteration
+                    auto reduce_start = clock::now();
+                    for (unsigned int j = 0; j < number_of_features; j++)
+                    {
+                        reduce_buffer[j] = local_theta[j] / m_workers;
+                    }
+                    reduce_buffer[number_of_features] = local_error;
+                    all_reduce.sum(reduce_buffer);
+                    for (unsigned int j = 0; j < number_of_features; j++)
+                    {
+                        local_theta[j] = reduce_buffer[j];
+                    }
+                    m_reduce_seconds += std::chrono::duration<double>(clock::now() - reduce_start).count();
+
+                    // Every rank sees the same reduced error, so all take the same
+                    // decisions below
+                    double current_error = reduce_buffer[number_of_features];
+                    if(verbose && (number_of_iterations / sync_period) % settings.print_err_modulo == 0)
+                    {
+                        int precision = std::numeric_limits<double>::max_digits10;
+                        std::cout << std::setprecision(precision) << "Error is: " << current_error << std::endl;
+                    }
+
+                    // Adaptive learning rate, as in GradientDescent::run
+                    if(previous_error > current_error)
+                    {
+                        alpha *= (1 + settings.adaptive_learning_rate);
+                    }
+                    else
+                    {
+                        alpha *= (1 - settings.adaptive_learning_rate);
+                    }
+                    previous_error = current_error;
+
+                    converge = convergence.converged(m_theta, local_theta, current_error, settings.eps, verbose);
+                    m_theta = local_theta;
+                }
+                number_of_iterations++;
+            }
+            return number_of_iterations;
+        }
+
+        // Training loop for a single rank, identical theta is returned on all ranks
+        std::vector<double> _run_worker(std::shared_ptr<RingTransport> transport, unsigned int rank)
+        {
+            transport->attach(rank);
+            RingAllReduce all_reduce(transport, rank, m_workers);
+            bool verbose = (rank == 0);
+
+            // Only an iteration cap: a wall-clock budget could stop ranks at
+            // different iterations and leave the ring waiting
+            unsigned int max_iterations = std::numeric_limits<unsigned int>::max();
+            if(this->m_config_params != nullptr && m_config_params->has("optimisation.grad.max_iterations"))
+            {
+                max_iterations = m_config_params->get<unsigned int>("optimisation.grad.max_iterations");
+            }
+
+            m_compute_seconds = 0.0;
+            m_reduce_seconds = 0.0;
+            m_iterations = m_bounded ? this->_run_bounded(all_reduce, rank, verbose, max_iterations)
+                                     : this->_run_sync(all_reduce, rank, verbose, max_iterations);
+
+            std::vector<double> timings = { m_compute_seconds, m_reduce_seconds };
+            all_reduce.sum(timings);
+            m_mean_compute_seconds = timings[0] / m_workers;
+            m_mean_reduce_seconds = timings[1] / m_workers;
+            return m_theta;
+        }
+
+    public:
+        explicit DistributedGradientDescent(std::vector<DataPoint>& data_point_samples,
+                                            std::vector<double>& initial_theta,
+                                            std::pair<double, double> minMaxPair,
+                                            std::shared_ptr<ConfigParameters> config_params = nullptr)
+        {
+            this->m_config_params = config_params;
+
+            m_err_func = std::shared_ptr<ErrorFunction>(new LinearErrorFunction());
+            m_err_func->add_params(config_params);
+            m_err_func->add_min_max_pair(minMaxPair);
+
+            // Theta also covers any derived features
+            number_of_features = 0;
+            m_data_points = data_point_samples;
+            number_of_training_points = data_point_samples.size();
+            if (number_of_training_points > 0)
+            {
+                number_of_features = m_err_func->number_of_parameters(
+                    data_point_samples[0].getFeatures().size());
+            }
+
+            m_theta = std::vector<double>(number_of_features, 1.0);
+            for(unsigned int i = 0; i < initial_theta.size(); i++)
+            {
+                m_theta[i] = initial_theta[i];
+            }
+
+            m_workers = 2;
+            m_transport = "unix";
+            m_bounded = false;
+            m_max_staleness = 0;
+            if(config_params != nullptr)
+            {
+                m_workers = config_params->get<unsigned int>("optimisation.dist.workers");
+                m_transport = config_params->getString("optimisation.dist.transport");
+                m_bounded = config_params->getString("optimisation.dist.mode") == "bounded";
+                if(m_bounded)
+                {
+                    m_max_staleness = config_params->get<unsigned int>("optimisation.dist.max_staleness");
+                }
+            }
+            else
+            {
+                std::cout << "Warning: No parameters passed, using 2 synchronous workers over unix sockets." << std::endl;
+            }
+            if(m_workers == 0)
+            {
+                throw std::string("optimisation.dist.workers must be at least 1");
+            }
+        }
+
+        // Forks workers 1..N-1, this process acts as rank 0
+        std::vector<double> run()
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::shared_ptr<RingTransport> transport = this->_make_transport();
+
+            // Don't duplicate buffered output into the children
+            std::cout.flush();
+
+            std::vector<pid_t> children;
+            for(unsigned int rank = 1; rank < m_workers; rank++)
+            {
+                pid_t pid = fork();
+                if(pid < 0)
+                {
+                    transport->abort();
+                    for(auto child: children)
+                    {
+                        kill(child, SIGTERM);
+                        waitpid(child, nullptr, 0);
+                    }
+                    throw std::string("unable to fork worker");
+                }
+                if(pid == 0)
+                {
+                    int status = 0;
+                    try
+                    {
+                        this->_run_worker(transport, rank);
+                    }
+                    catch(...)
+                    {
+                        transport->abort();
+                        status = 1;
+                    }
+                    std::cout.flush();
+                    _exit(status);
+                }
+                children.push_back(pid);
+            }
+
+            // Whatever rank 0 throws, unblock and reap the children first
+            std::exception_ptr failure;
+            try
+            {
+                this->_run_worker(transport, 0);
+            }
+            catch(...)
+            {
+                transport->abort();
+                failure = std::current_exception();
+            }
+
+            bool children_ok = true;
+            for(auto child: children)
+            {
+                int status = 0;
+                waitpid(child, &status, 0);
+                children_ok = children_ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            }
+            if(failure)
+            {
+                std::rethrow_exception(failure);
+            }
+            if(!children_ok)
+            {
+                throw std::string("distributed worker failed");
+            }
+            m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::cout << "Workers: " << m_workers << " (" << m_transport << ", "
+                      << (m_bounded ? "bounded" : "sync") << "), iterations: " << m_iterations
+                      << ", wall: " << m_seconds << "s, mean compute: " << m_mean_compute_seconds
+                      << "s, mean all-reduce: " << m_mean_reduce_seconds << "s" << std::endl;
+            return m_theta;
+        }
+
+        // Wall time of the last run, including starting the workers
+        double seconds() const
+        {
+            return m_seconds;
+        }
+
+        unsigned int workers() const
+        {
+            return m_workers;
+        }
+
+        bool bounded() const
+        {
+            return m_bounded;
+        }
+
+        // Scaling efficiency T1 / (N TN) of the last run, given the wall time
+        // T1 of the same run on one worker
+        double scaling_efficiency(double single_worker_seconds) const
+        {
+            return single_worker_seconds / (m_workers * std::max(m_seconds, 1e-12));
+        }
+};
+
+#endif
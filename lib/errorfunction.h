@@ -2,6 +2,8 @@
 #define ERR_FUNC_HH
 
 #include <vector>
+#include <string>
+#include <memory>
 
 // Optimisation datapoint
 #include "datapoint.h"
@@ -27,6 +29,44 @@ public:
     virtual std::vector<double> error_function_derivative (DataPoint data_point, 
                                                            std::vector<double> theta) = 0;
 
+    // Error function and the summed derivative over all data points. Override
+    // when both can be computed in a single pass over the data.
+    virtual double error_and_gradient(std::vector<double>& theta,
+                                      std::vector<DataPoint>& data_points,
+                                      std::vector<double>& gradient)
+    {
+        gradient.assign(theta.size(), 0.0);
+        for (unsigned int i = 0; i < data_points.size(); i++)
+        {
+            auto all_j_theta_derivs = this->error_function_derivative(data_points[i], theta);
+            for (unsigned int j = 0; j < gradient.size(); j++)
+            {
+                gradient[j] += all_j_theta_derivs[j];
+            }
+        }
+        return this->error_function(theta, data_points);
+    }
+
+    // For models whose per-row derivative is residual * row, as used by the
+    // variance-reduced solvers, which then store one scalar per row.
+    // d(row error)/d(prediction) at theta:
+    virtual double residual(std::vector<double>&, DataPoint&)
+    {
+        throw std::string("error function has no per-row residual");
+    }
+
+    // out += scale * row, out is theta-sized
+    virtual void add_scaled_row(DataPoint&, double, std::vector<double>&)
+    {
+        throw std::string("error function has no per-row residual");
+    }
+
+    // Length of theta for data points with number_of_features features
+    virtual unsigned int number_of_parameters(unsigned int number_of_features)
+    {
+        return number_of_features;
+    }
+
     // These should be set before calling error function or derivative, (only if they are used)
     virtual void add_params(std::shared_ptr<ConfigParameters> params) = 0;
 
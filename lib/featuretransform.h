@@ -0,0 +1,251 @@
+#ifndef FEATURE_TRANSFORM_H
+#define FEATURE_TRANSFORM_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// input parameters
+#include "parameter.hh"
+
+// Derived features generated from a raw row inside the hypothesis and gradient
+// kernels, so they never have to be stored in the DataPoints.
+//
+// Configured with optimisation.features, a comma separated list of:
+//   pow:c:p            feature c raised to the integer power p
+//   mul:c1:c2          product of features c1 and c2
+//   bucket:c:e1:...:ek one-hot bucket of feature c over ascending edges
+//                      e1..ek, i.e. k + 1 indicator features
+// Columns index the DataPoint features (0 is the intercept) and apply to the
+// normalised values. Derived parameters follow the raw ones in theta, in the
+// order listed.
+class FeatureTransform
+{
+private:
+    enum class Kind
+    {
+        power,
+        product,
+        bucket
+    };
+
+    struct Derived
+    {
+        Kind kind;
+        unsigned int column;
+        unsigned int other;
+        std::vector<double> edges;
+    };
+
+    std::vector<Derived> m_derived;
+
+    // Number of parameters added by the derived features
+    unsigned int m_extra_parameters = 0;
+
+    // Spec of each derived feature, for errors
+    std::vector<std::string> m_items;
+
+    static double _power(double value, unsigned int power)
+    {
+        double result = 1.0;
+        for(unsigned int i = 0; i < power; i++)
+        {
+            result *= value;
+        }
+        return result;
+    }
+
+    static unsigned int _bucket(const std::vector<double>& edges, double value)
+    {
+        return std::upper_bound(edges.begin(), edges.end(), value) - edges.begin();
+    }
+
+    static double _number(std::string arg, const std::string& item)
+    {
+        arg.erase(0, arg.find_first_not_of(" \t"));
+        arg.erase(arg.find_last_not_of(" \t") + 1);
+        size_t end = 0;
+        double value = 0.0;
+        try
+        {
+            value = std::stod(arg, &end);
+        }
+        catch(const std::exception&)
+        {
+            end = 0;
+        }
+        if(arg.empty() || end != arg.size() || !std::isfinite(value))
+        {
+            throw "invalid feature transform: " + item;
+        }
+        return value;
+    }
+
+    // Column indices and powers are non-negative integers
+    static unsigned int _integer(const std::string& arg, const std::string& item)
+    {
+        double value = _number(arg, item);
+        if(value < 0.0 || value != std::floor(value) || value > std::numeric_limits<unsigned int>::max())
+        {
+            throw "invalid feature transform, expected a non-negative integer: " + item;
+        }
+        return (unsigned int)value;
+    }
+
+public:
+    // number_of_features, when known, bounds the column indices; otherwise
+    // they are checked by number_of_parameters
+    explicit FeatureTransform(const std::string& spec, unsigned int number_of_features = 0)
+    {
+        std::istringstream is_spec(spec);
+        std::string item;
+        while(std::getline(is_spec, item, ','))
+        {
+            std::istringstream is_item(item);
+            std::string kind;
+            std::getline(is_item, kind, ':');
+            kind.erase(0, kind.find_first_not_of(" \t"));
+
+            std::vector<std::string> args;
+            std::string arg;
+            while(std::getline(is_item, arg, ':'))
+            {
+                args.push_back(arg);
+            }
+
+            Derived derived;
+            derived.other = 0;
+            if(kind == "pow" && args.size() == 2)
+            {
+                derived.kind = Kind::power;
+                derived.column = _integer(args[0], item);
+                derived.other = _integer(args[1], item);
+                m_extra_parameters += 1;
+            }
+            else if(kind == "mul" && args.size() == 2)
+            {
+                derived.kind = Kind::product;
+                derived.column = _integer(args[0], item);
+                derived.other = _integer(args[1], item);
+                m_extra_parameters += 1;
+            }
+            else if(kind == "bucket" && args.size() >= 2)
+            {
+                derived.kind = Kind::bucket;
+                derived.column = _integer(args[0], item);
+                for(unsigned int i = 1; i < args.size(); i++)
+                {
+                    derived.edges.push_back(_number(args[i], item));
+                }
+                std::sort(derived.edges.begin(), derived.edges.end());
+                m_extra_parameters += derived.edges.size() + 1;
+            }
+            else
+            {
+                throw "invalid feature transform: " + item;
+            }
+            m_derived.push_back(derived);
+            m_items.push_back(item);
+        }
+        if(number_of_features > 0)
+        {
+            this->validate(number_of_features);
+        }
+    }
+
+    // Throws unless every column index is below number_of_features
+    void validate(unsigned int number_of_features) const
+    {
+        for(unsigned int i = 0; i < m_derived.size(); i++)
+        {
+            const Derived& derived = m_derived[i];
+            bool second_column = (derived.kind == Kind::product);
+            if(derived.column >= number_of_features ||
+               (second_column && derived.other >= number_of_features))
+            {
+                throw "invalid feature transform, column out of range for " +
+                    std::to_string(number_of_features) + " features: " + m_items[i];
+            }
+        }
+    }
+
+    // nullptr when optimisation.features is not set
+    static std::shared_ptr<FeatureTransform> from_params(std::shared_ptr<ConfigParameters> params)
+    {
+        if(params == nullptr || !params->has("optimisation.features"))
+        {
+            return nullptr;
+        }
+        return std::make_shared<FeatureTransform>(params->getString("optimisation.features"));
+    }
+
+    // Length of theta for rows of number_of_features raw features, checking
+    // the column indices against them
+    unsigned int number_of_parameters(unsigned int number_of_features) const
+    {
+        this->validate(number_of_features);
+        return number_of_features + m_extra_parameters;
+    }
+
+    // Calls visit(parameter index, value) for each non-zero derived feature
+    template<class Visit>
+    void for_each_derived(const std::vector<double>& features, Visit visit) const
+    {
+        unsigned int index = features.size();
+        for(auto&& derived: m_derived)
+        {
+            double value = features[derived.column];
+            switch(derived.kind)
+            {
+                case Kind::power:
+                    visit(index, _power(value, derived.other));
+                    index += 1;
+                    break;
+                case Kind::product:
+                    visit(index, value * features[derived.other]);
+                    index += 1;
+                    break;
+                case Kind::bucket:
+                    visit(index + _bucket(derived.edges, value), 1.0);
+                    index += derived.edges.size() + 1;
+                    break;
+            }
+        }
+    }
+
+    // theta . [features, derived(features)]
+    double dot(const std::vector<double>& theta, const std::vector<double>& features) const
+    {
+        double sum = 0.0;
+        for (unsigned int i = 0; i < features.size(); i++)
+        {
+            sum += theta[i]*features[i];
+        }
+        this->for_each_derived(features, [&theta, &sum](unsigned int i, double value)
+        {
+            sum += theta[i]*value;
+        });
+        return sum;
+    }
+
+    // out = scale * [features, derived(features)], out has number_of_parameters entries
+    void scaled_row(const std::vector<double>& features, double scale, double* out) const
+    {
+        unsigned int number_of_features = features.size();
+        for (unsigned int i = 0; i < number_of_features; i++)
+        {
+            out[i] = scale * features[i];
+        }
+        std::fill(out + number_of_features, out + number_of_features + m_extra_parameters, 0.0);
+        this->for_each_derived(features, [out, scale](unsigned int i, double value)
+        {
+            out[i] = scale * value;
+        });
+    }
+};
+
+#endif
@@ -11,6 +11,8 @@
 #include <cmath>
 #include <utility>
 #include <memory>
+#include <functional>
+#include <random>
 
 // input parameters
 #include "parameter.hh"
@@ -22,6 +24,18 @@
 #include "datapoint.h"
 #include "linearerrorfunction.h"
 
+// Learning rate schedules and line searches
+#include "stepsize.h"
+
+// Budgets, cancellation and progress callbacks
+#include "trainingcontrol.h"
+
+// Importance sampling of rows
+#include "sampling.h"
+
+// Shared descent settings and stopping rule
+#include "convergence.h"
+
 // sum squares error function
 // #include "../wormerrorfunction.hh"
 
@@ -53,46 +67,27 @@ class GradientDescent
         // Error function
         std::shared_ptr<ErrorFunction> m_err_func;
 
+        // Stopping conditions other than convergence
+        TrainingControl m_control;
+
+        // Stopping rule, from the config at construction
+        ConvergenceCheck m_convergence;
+
         bool _convergence_function(std::vector<double> new_theta,
                                   double current_error,
                                   bool can_converge,
                                   double epsilon)
         {
-            // Currently has fixed minimum value for if stuck in saddle point
-            // whilst high error, i.e. converge is false when high error even
-            // if converging
-            double acceptable_error;
-            double theta_convergence;
-            if(this->m_config_params != nullptr)
-            {
-                acceptable_error = m_config_params->get<double>("optimisation.grad.acceptable_error");
-                theta_convergence = m_config_params->get<double>("optimisation.grad.theta_convergence");
-            }
-            else
+            if(this->m_config_params == nullptr)
             {
                 if(!this->warnings_shown)
                 {
                     std::cout << "Warning: No parameters passed, using base value for" <<
                     " acceptable error and theta convergence." << std::endl;
                 }
-                acceptable_error = 0.00001;
-                theta_convergence = 0.01;
                 warnings_shown = true;
             }
-
-            // Stop early
-            if(current_error < acceptable_error)
-            {
-                std::cout << "Current error below manual acceptable threshold level." << std::endl;
-                return true;
-            }
-
-            // Stop if theta params stopped changing
-            can_converge = current_error < theta_convergence;
-            for (unsigned int i = 0; i < m_theta.size(); i++)
-            {
-                can_converge = can_converge && fabs(m_theta[i]-new_theta[i]) < epsilon;
-            }
+            can_converge = m_convergence.converged(m_theta, new_theta, current_error, epsilon, true);
             return can_converge;
         }
 
@@ -127,6 +122,261 @@ class GradientDescent
             }      
        }
 
+        // Batch descent: one loss and gradient pass per accepted step, as the
+        // step strategies hand back the values at the new theta
+        std::vector<double> _run_batch(double alpha, double eps, double adaptive_learning_rate)
+        {
+            std::shared_ptr<BatchStepSize> step_size =
+                StepSizeFactory::make_batch_step(m_config_params, alpha, adaptive_learning_rate);
+
+            std::shared_ptr<ErrorFunction> err_func = this->m_err_func;
+            std::vector<DataPoint>& data_points = this->m_data_points;
+            BatchEvaluation evaluate = [err_func, &data_points](const std::vector<double>& theta,
+                                                                std::vector<double>& gradient)
+            {
+                std::vector<double> at = theta;
+                return err_func->error_and_gradient(at, data_points, gradient);
+            };
+
+            std::vector<double> gradient;
+            double current_error = evaluate(m_theta, gradient);
+
+            bool converge = false;
+            unsigned int number_of_iterations = 0;
+            while (!converge && !m_control.should_stop(number_of_iterations))
+            {
+                this->_update_error_logs(number_of_iterations, current_error);
+                m_control.report(number_of_iterations, current_error, m_theta);
+
+                std::vector<double> newTheta;
+                std::vector<double> new_gradient;
+                double new_error;
+                step_size->step(m_theta, gradient, current_error, evaluate,
+                                newTheta, new_gradient, new_error);
+                if(step_size->stalled())
+                {
+                    std::cout << "Warning: line search found no decrease, stopping." << std::endl;
+                    m_control.stalled();
+                    break;
+                }
+
+                converge = this->_convergence_function(newTheta, new_error, converge, eps);
+
+                m_theta = newTheta;
+                gradient = new_gradient;
+                current_error = new_error;
+                number_of_iterations++;
+            }
+            if(converge)
+            {
+                m_control.converged();
+            }
+
+            return m_theta;
+        }
+
+        // Rows are sampled uniformly with replacement (optimisation.grad.seed)
+        std::mt19937 _sampler() const
+        {
+            unsigned int seed = 1;
+            if(this->m_config_params != nullptr && m_config_params->has("optimisation.grad.seed"))
+            {
+                seed = m_config_params->get<unsigned int>("optimisation.grad.seed");
+            }
+            return std::mt19937(seed);
+        }
+
+        // Row sampler for optimisation.grad.sampling:importance, nullptr for the
+        // default in-order pass. Rows start scored by their gradient norm (or
+        // loss) at the initial theta.
+        std::shared_ptr<ImportanceSampler> _importance_sampler(bool& score_by_loss)
+        {
+            score_by_loss = false;
+            if(this->m_config_params == nullptr || !m_config_params->has("optimisation.grad.sampling") ||
+               m_config_params->getString("optimisation.grad.sampling") != "importance" ||
+               number_of_training_points == 0)
+            {
+                return nullptr;
+            }
+            double mix = 0.1;
+            unsigned int seed = 1;
+            if(m_config_params->has("optimisation.grad.importance_mix"))
+            {
+                mix = m_config_params->get<double>("optimisation.grad.importance_mix");
+            }
+            if(m_config_params->has("optimisation.grad.importance_score"))
+            {
+                score_by_loss = m_config_params->getString("optimisation.grad.importance_score") == "loss";
+            }
+            if(m_config_params->has("optimisation.grad.seed"))
+            {
+                seed = m_config_params->get<unsigned int>("optimisation.grad.seed");
+            }
+            std::vector<double> scores(number_of_training_points);
+            for (unsigned int i = 0; i < number_of_training_points; i++)
+            {
+                scores[i] = this->_importance_score(m_data_points[i], m_theta,
+                    this->m_err_func->error_function_derivative(m_data_points[i], m_theta), score_by_loss);
+            }
+            return std::make_shared<ImportanceSampler>(scores, mix, seed);
+        }
+
+        // Gradient norm of a row, or its weighted loss
+        double _importance_score(DataPoint& data_point, std::vector<double>& theta,
+                                 const std::vector<double>& derivatives, bool score_by_loss)
+        {
+            if(score_by_loss)
+            {
+                double weight = data_point.getWeight();
+                double residual = this->m_err_func->residual(theta, data_point);
+                return (weight > 0.0) ? 0.5 * residual * residual / weight : 0.0;
+            }
+            double sum = 0.0;
+            for (auto derivative: derivatives)
+            {
+                sum += derivative * derivative;
+            }
+            return std::sqrt(sum);
+        }
+
+        // SVRG: each epoch takes a full gradient snapshot, in the same single
+        // pass that gives the error, then makes N steps of
+        //   theta -= alpha * ((r_i(theta) - r_i(snapshot)) x_i + mean gradient)
+        // where r_i is the residual of row i
+        std::vector<double> _run_svrg(double alpha, double eps)
+        {
+            std::shared_ptr<LearningRateSchedule> schedule =
+                StepSizeFactory::make_variance_reduced_schedule(m_config_params, alpha);
+            std::mt19937 sampler = this->_sampler();
+            std::uniform_int_distribution<unsigned int> pick(0, number_of_training_points - 1);
+
+            std::vector<double> mean_gradient;
+            bool converge = false;
+            unsigned int number_of_iterations = 0;
+            while (!converge && !m_control.should_stop(number_of_iterations))
+            {
+                std::vector<double> snapshot = m_theta;
+                double current_error = this->m_err_func->error_and_gradient(snapshot, m_data_points, mean_gradient);
+                for (auto&& g: mean_gradient)
+                {
+                    g /= number_of_training_points;
+                }
+
+                this->_update_error_logs(number_of_iterations, current_error);
+                m_control.report(number_of_iterations, current_error, m_theta);
+                alpha = schedule->rate(number_of_iterations, current_error);
+
+                std::vector<double> newTheta = m_theta;
+                bool interrupted = false;
+                for (unsigned int i = 0; i < number_of_training_points; i++)
+                {
+                    if(i % 4096 == 4095 && m_control.is_cancelled())
+                    {
+                        interrupted = true;
+                        break;
+                    }
+                    DataPoint& data_point = m_data_points[pick(sampler)];
+                    double correction = this->m_err_func->residual(newTheta, data_point) -
+                                        this->m_err_func->residual(snapshot, data_point);
+                    for (unsigned int j = 0; j < number_of_features; j++)
+                    {
+                        newTheta[j] -= alpha * mean_gradient[j];
+                    }
+                    this->m_err_func->add_scaled_row(data_point, -alpha * correction, newTheta);
+                }
+
+                // A cancelled, partial epoch keeps its progress but is not
+                // tested for convergence, should_stop then ends the run
+                if(!interrupted)
+                {
+                    converge = this->_convergence_function(newTheta, current_error, converge, eps);
+                }
+                m_theta = newTheta;
+                number_of_iterations++;
+            }
+            if(converge)
+            {
+                m_control.converged();
+            }
+
+            return m_theta;
+        }
+
+        // SAGA: keeps the last residual seen for every row (one scalar each)
+        // and the mean of the stored gradients, stepping by
+        //   theta -= alpha * ((r_i(theta) - stored_i) x_i + mean stored gradient)
+        std::vector<double> _run_saga(double alpha, double eps)
+        {
+            std::shared_ptr<LearningRateSchedule> schedule =
+                StepSizeFactory::make_variance_reduced_schedule(m_config_params, alpha);
+            std::mt19937 sampler = this->_sampler();
+            std::uniform_int_distribution<unsigned int> pick(0, number_of_training_points - 1);
+
+            // Table and mean gradient at the initial theta
+            std::vector<double> stored_residuals(number_of_training_points);
+            for (unsigned int i = 0; i < number_of_training_points; i++)
+            {
+                stored_residuals[i] = this->m_err_func->residual(m_theta, m_data_points[i]);
+            }
+            std::vector<double> mean_gradient;
+            double current_error = this->m_err_func->error_and_gradient(m_theta, m_data_points, mean_gradient);
+            for (auto&& g: mean_gradient)
+            {
+                g /= number_of_training_points;
+            }
+
+            bool converge = false;
+            unsigned int number_of_iterations = 0;
+            while (!converge && !m_control.should_stop(number_of_iterations))
+            {
+                if(number_of_iterations > 0)
+                {
+                    current_error = this->m_err_func->error_function(m_theta, m_data_points);
+                }
+
+                this->_update_error_logs(number_of_iterations, current_error);
+                m_control.report(number_of_iterations, current_error, m_theta);
+                alpha = schedule->rate(number_of_iterations, current_error);
+
+                std::vector<double> newTheta = m_theta;
+                bool interrupted = false;
+                for (unsigned int i = 0; i < number_of_training_points; i++)
+                {
+                    if(i % 4096 == 4095 && m_control.is_cancelled())
+                    {
+                        interrupted = true;
+                        break;
+                    }
+                    unsigned int row = pick(sampler);
+                    DataPoint& data_point = m_data_points[row];
+                    double residual = this->m_err_func->residual(newTheta, data_point);
+                    double correction = residual - stored_residuals[row];
+                    for (unsigned int j = 0; j < number_of_features; j++)
+                    {
+                        newTheta[j] -= alpha * mean_gradient[j];
+                    }
+                    this->m_err_func->add_scaled_row(data_point, -alpha * correction, newTheta);
+                    this->m_err_func->add_scaled_row(data_point, correction / number_of_training_points, mean_gradient);
+                    stored_residuals[row] = residual;
+                }
+
+                // A cancelled, partial epoch keeps its progress but is not
+                // tested for convergence, should_stop then ends the run
+                if(!interrupted)
+                {
+                    converge = this->_convergence_function(newTheta, current_error, converge, eps);
+                }
+                m_theta = newTheta;
+                number_of_iterations++;
+            }
+            if(converge)
+            {
+                m_control.converged();
+            }
+
+            return m_theta;
+        }
+
     public:
         explicit GradientDescent(std::vector<DataPoint>& data_point_samples,
                                  std::vector<double>& initial_theta,
@@ -136,13 +386,19 @@ class GradientDescent
             // Store the config params
             this->m_config_params = config_params;
 
-            // Set sizes
+            // Open the error function
+            m_err_func = std::shared_ptr<ErrorFunction>(new LinearErrorFunction());
+            m_err_func->add_params(config_params);
+            m_err_func->add_min_max_pair(minMaxPair);
+
+            // Set sizes, theta also covers any derived features
             number_of_features = 0;
             m_data_points = data_point_samples;
             number_of_training_points = data_point_samples.size();
             if (number_of_training_points > 0)
             {
-                number_of_features = data_point_samples[0].getFeatures().size();
+                number_of_features = m_err_func->number_of_parameters(
+                    data_point_samples[0].getFeatures().size());
             }
 
             // Initialise theta values
@@ -153,45 +409,87 @@ class GradientDescent
                 m_theta[i] = initial_theta[i];
             }
 
-            // Open the error function
-            m_err_func = std::shared_ptr<ErrorFunction>(new LinearErrorFunction());
-            m_err_func->add_params(config_params);
-            m_err_func->add_min_max_pair(minMaxPair);
+            m_control.add_params(config_params);
+            m_convergence = ConvergenceCheck(config_params);
         }
 
-        std::vector<double> run()
+        // Stop after max_iterations epochs or max_seconds, whichever is first
+        void set_budget(unsigned int max_iterations, double max_seconds)
         {
-            // Initial learning rate (0.0000001)
-            double alpha;
+            m_control.set_budget(max_iterations, max_seconds);
+        }
 
-            // Convergence delta epsilon (0.00001)
-            double eps;
+        // Replace the token, e.g. to share one between several runs
+        void set_cancellation_token(std::shared_ptr<CancellationToken> token)
+        {
+            m_control.set_cancellation_token(token);
+        }
+
+        // Stop the run at the next check, safe to call from any thread
+        void cancel()
+        {
+            m_control.cancellation_token()->cancel();
+        }
 
-            // Percentage by which to adjust learning rate at each iteration
-            float adaptive_learning_rate;
+        // Called with the error and theta every every_n_iterations epochs,
+        // on the training thread
+        void set_progress_callback(std::function<void(const TrainingProgress&)> callback,
+                                   unsigned int every_n_iterations = 1)
+        {
+            m_control.set_progress_callback(callback, every_n_iterations);
+        }
 
-            // Momentum rate
-            float momentum_gamma;
+        // Why the last run returned
+        StopReason stop_reason() const
+        {
+            return m_control.stop_reason();
+        }
 
+        std::vector<double> run()
+        {
             // Set using file if available, or defaults otherwise
-            if(this->m_config_params != nullptr)
+            if(this->m_config_params == nullptr)
             {
-                alpha = m_config_params->get<double>("optimisation.grad.alpha");
-                eps = m_config_params->get<double>("optimisation.grad.eps");
-                adaptive_learning_rate = m_config_params->get<double>("optimisation.grad.adaptive_learning_rate");
-                momentum_gamma = m_config_params->get<double>("optimisation.grad.momentum_gamma");
+                std::cout << "Warning: No parameters passed, using base gradient descent settings." << std::endl;
             }
-            else
+            DescentSettings settings(m_config_params);
+            double alpha = settings.alpha;
+            double eps = settings.eps;
+            float adaptive_learning_rate = settings.adaptive_learning_rate;
+            float momentum_gamma = settings.momentum_gamma;
+
+            m_control.start();
+
+            std::string mode = "stochastic";
+            if(this->m_config_params != nullptr && m_config_params->has("optimisation.grad.mode"))
             {
-                std::cout << "Warning: No parameters passed, using base gradient descent settings." << std::endl;
-                alpha = 0.01;
-                eps = 0.00001;
-                adaptive_learning_rate = 0.05;
-                momentum_gamma = 0.9;
+                mode = m_config_params->getString("optimisation.grad.mode");
+            }
+            if(mode != "stochastic" && mode != "batch" && mode != "svrg" && mode != "saga")
+            {
+                throw std::string("unknown optimisation.grad.mode: " + mode);
+            }
+
+            // Full batch descent, step from a line search or schedule
+            if(mode == "batch")
+            {
+                return this->_run_batch(alpha, eps, adaptive_learning_rate);
+            }
+
+            // Variance-reduced stochastic descent
+            if((mode == "svrg" || mode == "saga") && number_of_training_points > 0)
+            {
+                return (mode == "svrg") ? this->_run_svrg(alpha, eps)
+                                        : this->_run_saga(alpha, eps);
             }
-            
-            // Used for monitoring the error rate (adaptive learning)
-            double previous_error = std::numeric_limits<double>::max();
+
+            // Learning rate per epoch (optimisation.grad.step)
+            std::shared_ptr<LearningRateSchedule> schedule =
+                StepSizeFactory::make_schedule(m_config_params, alpha, adaptive_learning_rate);
+
+            // Rows in order, or drawn by importance and reweighted
+            bool score_by_loss = false;
+            std::shared_ptr<ImportanceSampler> sampler = this->_importance_sampler(score_by_loss);
 
             // Internal momentum flag/ 
             std::vector<double> previous_j_theta_deriv = std::vector<double>(number_of_features, 1.0);
@@ -206,7 +504,7 @@ class GradientDescent
             // Used for storing the current iteration's error, so not recalculated
             double current_error = std::numeric_limits<double>::max();
 
-            while (!converge)
+            while (!converge && !m_control.should_stop(number_of_iterations))
             {
                 std::vector<double> newTheta = m_theta;
 
@@ -216,30 +514,42 @@ class GradientDescent
 
                 // Log the errors (print/ graph etc.)
                 this->_update_error_logs(number_of_iterations, current_error);
+                m_control.report(number_of_iterations, current_error, m_theta);
 
-                // Compare error rate and use adaptive learning rate
-                if(previous_error > current_error)
-                {
-                    // If the error is reducing accelerate learning rate
-                    alpha *= (1 + adaptive_learning_rate);
-                }
-                else
-                {
-                    // If the error is increasing or stationary, reduce learning rate
-                    alpha *= (1 - adaptive_learning_rate);
-                }
-
-                // Update tab of the error
-                previous_error = current_error;
+                // Learning rate for this epoch
+                alpha = schedule->rate(number_of_iterations, current_error);
 
+                bool interrupted = false;
                 for (unsigned int i = 0; i < number_of_training_points; i++)
                 {
+                    // Cheap cancellation check within long epochs
+                    if(i % 4096 == 4095 && m_control.is_cancelled())
+                    {
+                        interrupted = true;
+                        break;
+                    }
+
                     // Single training exaple
-                    DataPoint data_point = m_data_points[i];
+                    unsigned int row = i;
+                    double reweight = 1.0;
+                    if(sampler)
+                    {
+                        row = sampler->sample(reweight);
+                    }
+                    DataPoint data_point = m_data_points[row];
 
                     // Calculate the partial derivatives of the error function w.r.t.
                     // to each parameter
                     auto all_j_theta_derivs = this->m_err_func->error_function_derivative(data_point, newTheta);
+                    if(sampler)
+                    {
+                        sampler->update(row, this->_importance_score(data_point, newTheta,
+                                                                     all_j_theta_derivs, score_by_loss));
+                        for (auto&& derivative: all_j_theta_derivs)
+                        {
+                            derivative *= reweight;
+                        }
+                    }
 
                     // Apply the learning rate to each feature and add in momentum
                     for (unsigned int j = 0; j < number_of_features; j++)
@@ -267,13 +577,25 @@ class GradientDescent
                     is_previous_j_theta_deriv_set = true;
 
                 }
+                if(sampler)
+                {
+                    sampler->refresh();
+                }
 
-                // Have the parameters converged?
-                converge = this->_convergence_function(newTheta, current_error, converge, eps);
+                // Have the parameters converged? Not judged on a cancelled,
+                // partial epoch, should_stop then ends the run
+                if(!interrupted)
+                {
+                    converge = this->_convergence_function(newTheta, current_error, converge, eps);
+                }
 
                 m_theta = newTheta;
                 number_of_iterations++;
             }
+            if(converge)
+            {
+                m_control.converged();
+            }
 
             return m_theta;
         }
@@ -4,78 +4,614 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <algorithm>
 
-// #include "third-party/matplotlibcpp.h"
-
+// Renders error traces to SVG or PNG (chosen by the file extension) without
+// any external runtime. Long traces are downsampled to at most max_points
+// points first, with Largest-Triangle-Three-Buckets or min/max bucketing,
+// both linear in the trace length.
 class GraphPlotter
 {
+public:
+    enum class Downsampling
+    {
+        lttb,
+        min_max
+    };
+
 private:
+    typedef std::pair<double, double> Point;
+
+    unsigned int m_width;
+    unsigned int m_height;
+    unsigned int m_max_points;
+    Downsampling m_downsampling;
+
+    // Plot area inside the image
+    static const int margin_left = 80;
+    static const int margin_right = 20;
+    static const int margin_top = 40;
+    static const int margin_bottom = 50;
+
+    // Indexed PNG colours
+    enum Colour : uint8_t
+    {
+        white = 0,
+        black = 1,
+        grey = 2,
+        blue = 3
+    };
+
+    struct Layout
+    {
+        std::vector<Point> points;
+        double x_min, x_max, y_min, y_max;
+        std::vector<double> x_ticks, y_ticks;
+        std::string title, legend, xlabel, ylabel;
+    };
+
+    // Upper bound on ticks per axis
+    static const unsigned int max_ticks = 20;
+
+    // About five round numbers covering [min, max]
+    static std::vector<double> _ticks(double min, double max)
+    {
+        std::vector<double> ticks;
+        double range = max - min;
+        if(!(range > 0.0))
+        {
+            ticks.push_back(min);
+            return ticks;
+        }
+        double step = std::pow(10.0, std::floor(std::log10(range / 5.0)));
+        double scaled = range / (5.0 * step);
+        step *= (scaled >= 5.0) ? 10.0 : (scaled >= 2.0) ? 5.0 : (scaled >= 1.0) ? 2.0 : 1.0;
+        double first = std::ceil(min / step) * step;
+        if(first + step == first)
+        {
+            // The step is lost in the rounding of the values themselves
+            ticks.push_back(min);
+            ticks.push_back(max);
+            return ticks;
+        }
+        // Each tick from its index, so rounding cannot stall the loop
+        for(unsigned int k = 0; k <= max_ticks; k++)
+        {
+            double tick = first + k * step;
+            if(tick > max + step * 1e-9)
+            {
+                break;
+            }
+            ticks.push_back(std::fabs(tick) < step * 1e-9 ? 0.0 : tick);
+        }
+        return ticks;
+    }
+
+    static std::string _label(double value)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.4g", value);
+        return text;
+    }
+
+    double _px(const Layout& layout, double x) const
+    {
+        double span = layout.x_max - layout.x_min;
+        double t = span > 0.0 ? (x - layout.x_min) / span : 0.5;
+        return margin_left + t * (m_width - margin_left - margin_right);
+    }
+
+    double _py(const Layout& layout, double y) const
+    {
+        double span = layout.y_max - layout.y_min;
+        double t = span > 0.0 ? (y - layout.y_min) / span : 0.5;
+        return m_height - margin_bottom - t * (m_height - margin_top - margin_bottom);
+    }
+
+    // SVG
+
+    static std::string _escape(const std::string& text)
+    {
+        std::string escaped;
+        for(auto c: text)
+        {
+            switch(c)
+            {
+                case '&': escaped += "&amp;"; break;
+                case '<': escaped += "&lt;"; break;
+                case '>': escaped += "&gt;"; break;
+                default: escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    void _write_svg(const Layout& layout, const std::string& path) const
+    {
+        std::ofstream file(path.c_str());
+        if(!file.is_open())
+        {
+            throw "unable to write graph: " + path;
+        }
+        int left = margin_left;
+        int right = m_width - margin_right;
+        int top = margin_top;
+        int bottom = m_height - margin_bottom;
+
+        file << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << m_width << "\" height=\"" << m_height
+             << "\" font-family=\"sans-serif\" font-size=\"12\">\n";
+        file << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n";
+        for(auto tick: layout.y_ticks)
+        {
+            double y = _py(layout, tick);
+            file << "<line x1=\"" << left << "\" y1=\"" << y << "\" x2=\"" << right << "\" y2=\"" << y
+                 << "\" stroke=\"#ddd\"/>\n";
+            file << "<text x=\"" << left - 6 << "\" y=\"" << y + 4 << "\" text-anchor=\"end\">"
+                 << _label(tick) << "</text>\n";
+        }
+        for(auto tick: layout.x_ticks)
+        {
+            double x = _px(layout, tick);
+            file << "<line x1=\"" << x << "\" y1=\"" << top << "\" x2=\"" << x << "\" y2=\"" << bottom
+                 << "\" stroke=\"#ddd\"/>\n";
+            file << "<text x=\"" << x << "\" y=\"" << bottom + 16 << "\" text-anchor=\"middle\">"
+                 << _label(tick) << "</text>\n";
+        }
+        file << "<rect x=\"" << left << "\" y=\"" << top << "\" width=\"" << right - left << "\" height=\""
+             << bottom - top << "\" fill=\"none\" stroke=\"black\"/>\n";
+
+        file << "<polyline fill=\"none\" stroke=\"#1f77b4\" stroke-width=\"1.5\" points=\"";
+        file.precision(6);
+        for(auto&& point: layout.points)
+        {
+            file << _px(layout, point.first) << "," << _py(layout, point.second) << " ";
+        }
+        file << "\"/>\n";
+
+        file << "<text x=\"" << m_width / 2 << "\" y=\"" << top - 14 << "\" text-anchor=\"middle\" font-size=\"16\">"
+             << _escape(layout.title) << "</text>\n";
+        file << "<text x=\"" << right - 6 << "\" y=\"" << top + 18 << "\" text-anchor=\"end\" fill=\"#1f77b4\">"
+             << _escape(layout.legend) << "</text>\n";
+        file << "<text x=\"" << (left + right) / 2 << "\" y=\"" << m_height - 12 << "\" text-anchor=\"middle\">"
+             << _escape(layout.xlabel) << "</text>\n";
+        file << "<text transform=\"translate(16," << (top + bottom) / 2 << ") rotate(-90)\" text-anchor=\"middle\">"
+             << _escape(layout.ylabel) << "</text>\n";
+        file << "</svg>\n";
+    }
+
+    // PNG
+
+    struct Raster
+    {
+        unsigned int width, height;
+        std::vector<uint8_t> pixels;
+
+        void set(int x, int y, uint8_t colour)
+        {
+            if(x >= 0 && y >= 0 && x < (int)width && y < (int)height)
+            {
+                pixels[(size_t)y * width + x] = colour;
+            }
+        }
+
+        // Bresenham, thickened vertically by one pixel
+        void line(int x0, int y0, int x1, int y1, uint8_t colour, bool thick = false)
+        {
+            int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+            int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+            int error = dx + dy;
+            while(true)
+            {
+                this->set(x0, y0, colour);
+                if(thick)
+                {
+                    this->set(x0, y0 + 1, colour);
+                }
+                if(x0 == x1 && y0 == y1)
+                {
+                    break;
+                }
+                int e2 = 2 * error;
+                if(e2 >= dy)
+                {
+                    error += dy;
+                    x0 += sx;
+                }
+                if(e2 <= dx)
+                {
+                    error += dx;
+                    y0 += sy;
+                }
+            }
+        }
+
+        // 3x5 glyphs for tick labels, one bit per pixel, top row first
+        static uint16_t glyph(char c)
+        {
+            switch(c)
+            {
+                case '0': return 075557;
+                case '1': return 026227;
+                case '2': return 071747;
+                case '3': return 071717;
+                case '4': return 055711;
+                case '5': return 074717;
+                case '6': return 074757;
+                case '7': return 071111;
+                case '8': return 075757;
+                case '9': return 075717;
+                case '.': return 000002;
+                case '-': return 000700;
+                case '+': return 002720;
+                case 'e': return 003743;
+                default: return 0;
+            }
+        }
+
+        // Text at scale 2, anchored on the left, centre or right of x
+        void text(const std::string& value, int x, int y, int anchor)
+        {
+            int advance = 8;
+            int width = value.size() * advance - 2;
+            x -= (anchor == 0) ? 0 : (anchor == 1) ? width / 2 : width;
+            for(auto c: value)
+            {
+                uint16_t bits = glyph(c);
+                for(int row = 0; row < 5; row++)
+                {
+                    for(int column = 0; column < 3; column++)
+                    {
+                        if(bits & (1 << ((4 - row) * 3 + (2 - column))))
+                        {
+                            for(int k = 0; k < 4; k++)
+                            {
+                                this->set(x + 2 * column + k % 2, y + 2 * row + k / 2, black);
+                            }
+                        }
+                    }
+                }
+                x += advance;
+            }
+        }
+    };
+
+    static std::vector<uint32_t> _crc_table()
+    {
+        std::vector<uint32_t> table(256);
+        for(uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }
+
+    static uint32_t _crc(const uint8_t* data, size_t size, uint32_t crc = 0xffffffffu)
+    {
+        // Initialised once, thread safe
+        static const std::vector<uint32_t> table = _crc_table();
+        for(size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    static void _put32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back(value >> 24);
+        out.push_back(value >> 16);
+        out.push_back(value >> 8);
+        out.push_back(value);
+    }
+
+    static void _chunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> chunk;
+        _put32(chunk, data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        uint32_t crc = _crc(&chunk[4], chunk.size() - 4) ^ 0xffffffffu;
+        _put32(chunk, crc);
+        file.write(reinterpret_cast<const char*>(&chunk[0]), chunk.size());
+    }
+
+    // Indexed colour PNG, zlib stream made of stored (uncompressed) blocks
+    static void _write_png(const Raster& raster, const std::string& path)
+    {
+        std::ofstream file(path.c_str(), std::ios::binary);
+        if(!file.is_open())
+        {
+            throw "unable to write graph: " + path;
+        }
+        static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+        file.write(reinterpret_cast<const char*>(signature), 8);
+
+        std::vector<uint8_t> header;
+        _put32(header, raster.width);
+        _put32(header, raster.height);
+        header.push_back(8);    // bit depth
+        header.push_back(3);    // indexed colour
+        header.push_back(0);
+        header.push_back(0);
+        header.push_back(0);
+        _chunk(file, "IHDR", header);
+
+        std::vector<uint8_t> palette = {255, 255, 255,  0, 0, 0,  221, 221, 221,  31, 119, 180};
+        _chunk(file, "PLTE", palette);
+
+        // Each scanline is preceded by filter type 0
+        std::vector<uint8_t> raw;
+        raw.reserve((size_t)(raster.width + 1) * raster.height);
+        for(unsigned int y = 0; y < raster.height; y++)
+        {
+            raw.push_back(0);
+            raw.insert(raw.end(), raster.pixels.begin() + (size_t)y * raster.width,
+                       raster.pixels.begin() + (size_t)(y + 1) * raster.width);
+        }
+
+        std::vector<uint8_t> data = {0x78, 0x01};
+        uint32_t a = 1, b = 0;
+        size_t offset = 0;
+        while(true)
+        {
+            size_t size = std::min<size_t>(65535, raw.size() - offset);
+            bool last = (offset + size == raw.size());
+            data.push_back(last ? 1 : 0);
+            data.push_back(size & 0xff);
+            data.push_back(size >> 8);
+            data.push_back(~size & 0xff);
+            data.push_back((~size >> 8) & 0xff);
+            for(size_t i = offset; i < offset + size; i++)
+            {
+                a = (a + raw[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+            offset += size;
+            if(last)
+            {
+                break;
+            }
+        }
+        _put32(data, (b << 16) | a);
+        _chunk(file, "IDAT", data);
+        _chunk(file, "IEND", std::vector<uint8_t>());
+    }
+
+    void _render_png(const Layout& layout, const std::string& path) const
+    {
+        Raster raster;
+        raster.width = m_width;
+        raster.height = m_height;
+        raster.pixels.assign((size_t)m_width * m_height, white);
+
+        int left = margin_left;
+        int right = m_width - margin_right;
+        int top = margin_top;
+        int bottom = m_height - margin_bottom;
+
+        for(auto tick: layout.y_ticks)
+        {
+            int y = std::lround(_py(layout, tick));
+            raster.line(left, y, right, y, grey);
+            raster.text(_label(tick), left - 8, y - 5, 2);
+        }
+        for(auto tick: layout.x_ticks)
+        {
+            int x = std::lround(_px(layout, tick));
+            raster.line(x, top, x, bottom, grey);
+            raster.text(_label(tick), x, bottom + 8, 1);
+        }
+
+        for(size_t i = 1; i < layout.points.size(); i++)
+        {
+            raster.line(std::lround(_px(layout, layout.points[i - 1].first)),
+                        std::lround(_py(layout, layout.points[i - 1].second)),
+                        std::lround(_px(layout, layout.points[i].first)),
+                        std::lround(_py(layout, layout.points[i].second)), blue, true);
+        }
+
+        raster.line(left, top, right, top, black);
+        raster.line(left, bottom, right, bottom, black);
+        raster.line(left, top, left, bottom, black);
+        raster.line(right, top, right, bottom, black);
+
+        _write_png(raster, path);
+    }
+
 public:
-    explicit GraphPlotter(){}
+    explicit GraphPlotter(unsigned int width = 800,
+                          unsigned int height = 600,
+                          unsigned int max_points = 2000,
+                          Downsampling downsampling = Downsampling::lttb)
+        : m_width(std::max(width, 200u)),
+          m_height(std::max(height, 150u)),
+          m_max_points(std::max(max_points, 3u)),
+          m_downsampling(downsampling)
+    {
+    }
+
+    // Largest-Triangle-Three-Buckets: keeps the first and last points and, from
+    // each bucket in between, the point making the largest triangle with the
+    // previous pick and the mean of the next bucket
+    static std::vector<Point> lttb(const std::vector<Point>& points, unsigned int threshold)
+    {
+        size_t n = points.size();
+        if(threshold >= n || threshold < 3)
+        {
+            return points;
+        }
+        std::vector<Point> sampled;
+        sampled.reserve(threshold);
+        sampled.push_back(points[0]);
+
+        double bucket_size = (double)(n - 2) / (threshold - 2);
+        size_t previous = 0;
+        for(unsigned int bucket = 0; bucket < threshold - 2; bucket++)
+        {
+            size_t first = (size_t)(bucket * bucket_size) + 1;
+            size_t last = (size_t)((bucket + 1) * bucket_size) + 1;
+
+            // Mean of the next bucket (the last point for the final bucket)
+            size_t next_first = last;
+            size_t next_last = std::min<size_t>((size_t)((bucket + 2) * bucket_size) + 1, n);
+            double mean_x = 0.0, mean_y = 0.0;
+            for(size_t i = next_first; i < next_last; i++)
+            {
+                mean_x += points[i].first;
+                mean_y += points[i].second;
+            }
+            size_t count = next_last - next_first;
+            mean_x /= count;
+            mean_y /= count;
 
-    void plot_error_graph(std::vector<double> error_vector,
+            double largest = -1.0;
+            size_t chosen = first;
+            const Point& a = points[previous];
+            for(size_t i = first; i < last; i++)
+            {
+                double area = std::fabs((a.first - mean_x) * (points[i].second - a.second) -
+                                        (a.first - points[i].first) * (mean_y - a.second));
+                if(area > largest)
+                {
+                    largest = area;
+                    chosen = i;
+                }
+            }
+            sampled.push_back(points[chosen]);
+            previous = chosen;
+        }
+        sampled.push_back(points[n - 1]);
+        return sampled;
+    }
+
+    // Keeps the lowest and highest point of each bucket, in order, so spikes
+    // survive downsampling
+    static std::vector<Point> min_max(const std::vector<Point>& points, unsigned int threshold)
+    {
+        size_t n = points.size();
+        if(threshold >= n || threshold < 2)
+        {
+            return points;
+        }
+        std::vector<Point> sampled;
+        unsigned int buckets = threshold / 2;
+        for(unsigned int bucket = 0; bucket < buckets; bucket++)
+        {
+            size_t first = n * bucket / buckets;
+            size_t last = n * (bucket + 1) / buckets;
+            size_t low = first, high = first;
+            for(size_t i = first; i < last; i++)
+            {
+                low = (points[i].second < points[low].second) ? i : low;
+                high = (points[i].second > points[high].second) ? i : high;
+            }
+            sampled.push_back(points[std::min(low, high)]);
+            if(low != high)
+            {
+                sampled.push_back(points[std::max(low, high)]);
+            }
+        }
+        return sampled;
+    }
+
+    // Saves error_vector against iteration number as .svg or .png (by the
+    // extension of save_title). log_error plots log10 of the error, dropping
+    // non-positive values; graph_end_trim_percentage of the points is trimmed
+    // from each end. There is no window to display to, so display_graph only
+    // reports where the graph was written.
+    void plot_error_graph(const std::vector<double>& error_vector,
                           const char* save_title,
                           bool display_graph = true,
                           bool log_error = false,
                           double graph_end_trim_percentage = 0.1)
     {
-        // if(log_error)
-        // {
-        //     std::vector<double>log_errors(error_vector.size());
-        //     // Plot the log error
-        //     for(unsigned int i = 0; i < error_vector.size(); i++)
-        //     {
-        //         log_errors[i] = std::log10(error_vector[i]);
-        //     }
-        //     error_vector = log_errors;
-        // }
-
-        // int size = error_vector.size();
-        // int ten_percent_size = size * graph_end_trim_percentage;
-        // std::vector<double>::const_iterator first = error_vector.begin() + ten_percent_size;
-        // std::vector<double>::const_iterator last = error_vector.end() - ten_percent_size;
-        // std::vector<double> trimmed_vector(first, last);
-        // // Construct Name for plot
-        // int number_displayed = (size - (2*ten_percent_size));
-        
-        // // Clear the plot
-        // matplotlibcpp::clf();
-
-        // std::string plot_name = "Error (" + std::to_string(size) + 
-        //     " iterations, " + std::to_string(number_displayed) + " displayed)";
-        // // Named plot
-        // matplotlibcpp::named_plot(plot_name, trimmed_vector);
-        // // Add graph title
-        // matplotlibcpp::title("Gradient Descent (Error per Iteration)");
-        // matplotlibcpp::xlabel("Iteration Number");
-        // if(log_error)
-        // {
-        //     matplotlibcpp::ylabel("log(L2 Error)");
-        // }
-        // else
-        // {
-        //     matplotlibcpp::ylabel("L2 Error");
-        // }
-        // // Enable legend.
-        // // matplotlibcpp::legend();
-        // // Save the image (file format is determined by the extension)
-
-        // try 
-        // { 
-        //     matplotlibcpp::save(save_title);
-        // }
-        // catch (const std::exception& e)
-        // {
-        //     std::cout << std::endl << e.what() << std::endl;
-        //     std::cout << "Expects folder to exist: './optimisation-graphs'" << std::endl;
-        // }
-        
-        // if(display_graph)
-        // {
-        //     matplotlibcpp::show();
-        // }
+        std::string path(save_title);
+        size_t size = error_vector.size();
+        size_t trim = size * std::min(std::max(graph_end_trim_percentage, 0.0), 0.5);
+        size_t number_displayed = size - std::min(size, 2 * trim);
+
+        Layout layout;
+        layout.points.reserve(number_displayed);
+        for(size_t i = trim; i < trim + number_displayed; i++)
+        {
+            double value = log_error ? std::log10(error_vector[i]) : error_vector[i];
+            if(std::isfinite(value))
+            {
+                layout.points.push_back(Point(i, value));
+            }
+        }
+        layout.points = (m_downsampling == Downsampling::lttb) ?
+            lttb(layout.points, m_max_points) : min_max(layout.points, m_max_points);
+
+        layout.x_min = trim;
+        layout.x_max = std::max<double>(trim, trim + number_displayed - 1);
+        layout.y_min = 0.0;
+        layout.y_max = 1.0;
+        if(!layout.points.empty())
+        {
+            layout.y_min = layout.y_max = layout.points[0].second;
+            for(auto&& point: layout.points)
+            {
+                layout.y_min = std::min(layout.y_min, point.second);
+                layout.y_max = std::max(layout.y_max, point.second);
+            }
+            double pad = (layout.y_max - layout.y_min) * 0.05;
+            pad = (pad > 0.0) ? pad : std::max(std::fabs(layout.y_min) * 0.05, 1e-12);
+            layout.y_min -= pad;
+            layout.y_max += pad;
+        }
+        layout.x_ticks = _ticks(layout.x_min, layout.x_max);
+        layout.y_ticks = _ticks(layout.y_min, layout.y_max);
+
+        layout.title = "Gradient Descent (Error per Iteration)";
+        layout.legend = "Error (" + std::to_string(size) + " iterations, " +
+            std::to_string(number_displayed) + " displayed)";
+        layout.xlabel = "Iteration Number";
+        layout.ylabel = log_error ? "log(L2 Error)" : "L2 Error";
+
+        std::string extension = path.substr(path.find_last_of('.') + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        try
+        {
+            if(extension == "svg")
+            {
+                this->_write_svg(layout, path);
+            }
+            else if(extension == "png")
+            {
+                this->_render_png(layout, path);
+            }
+            else
+            {
+                throw "unsupported graph format: " + path;
+            }
+        }
+        catch(const std::string& e)
+        {
+            std::cout << std::endl << e << std::endl;
+            std::cout << "Expects folder to exist: './optimisation-graphs'" << std::endl;
+            return;
+        }
+
+        if(display_graph)
+        {
+            std::cout << "Graph saved to " << path << " (" << layout.points.size()
+                      << " of " << number_displayed << " points drawn)" << std::endl;
+        }
     }
 
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -11,6 +11,12 @@
 // input parameters
 #include "parameter.hh"
 
+// Reproducible sums
+#include "reduction.h"
+
+// Derived features computed in the kernels
+#include "featuretransform.h"
+
 class LinearErrorFunction : public ErrorFunction
 {
 private:
@@ -20,31 +26,85 @@ private:
     // The normalised min/ max
     std::pair<double, double> m_data_minMaxPair;
 
-    // Hypothesis e.g. Model
-    std::vector<double> hypothesis(std::vector<double>& theta, 
-                                   std::vector<double>& features)
+    // Threads used for the full data reductions (optimisation.reduce.threads)
+    unsigned int m_reduce_threads = 1;
+
+    // Optional derived features (optimisation.features)
+    std::shared_ptr<FeatureTransform> m_transform;
+
+    // theta . features, without allocating
+    static double _dot(const std::vector<double>& theta,
+                       const std::vector<double>& features)
     {
         double sum = 0.0;
         for (unsigned int i = 0; i < features.size(); i++)
         {
             sum += theta[i]*features[i];
         }
-        return std::vector<double>(1, sum);
+        return sum;
+    }
+
+    // theta . features, including any derived features
+    double _hypothesis_value(const std::vector<double>& theta,
+                             const std::vector<double>& features) const
+    {
+        return m_transform ? m_transform->dot(theta, features) : _dot(theta, features);
+    }
+
+    // out = difference * features (and derived features), theta-sized
+    void _scaled_row(const std::vector<double>& features, double difference, double* out) const
+    {
+        if(m_transform)
+        {
+            m_transform->scaled_row(features, difference, out);
+            return;
+        }
+        for (unsigned int j = 0; j < features.size(); j++)
+        {
+            out[j] = difference * features[j];
+        }
+    }
+
+    // Hypothesis e.g. Model
+    std::vector<double> hypothesis(std::vector<double>& theta, 
+                                   std::vector<double>& features)
+    {
+        return std::vector<double>(1, _hypothesis_value(theta, features));
     }
 
 public:
 
-    // Error Function e.g. SSE
-    double error_function(std::vector<double>& theta, 
-                          std::vector<DataPoint>& data_points)
+    // One row's terms of the weighted loss and gradient pass, shared by the
+    // batch trainers so their sums agree bit for bit: out[0, width) is
+    // weight * (theta . row - target) * row and out[width] the weighted
+    // squared residual
+    static inline void row_terms(const double* row, unsigned int width, const double* theta,
+                                 double target, double weight, double* out)
     {
         double sum = 0.0;
-        for (unsigned int i = 0; i < data_points.size(); i++)
+        for (unsigned int j = 0; j < width; j++)
         {
-            double diff_1 = this->hypothesis(theta, data_points[i].getFeatures())[0] - 
-                data_points[i].getTarget(0);
-            sum += diff_1 * diff_1;
+            sum += theta[j]*row[j];
         }
+        double difference = sum - target;
+        double weighted = weight * difference;
+        for (unsigned int j = 0; j < width; j++)
+        {
+            out[j] = weighted * row[j];
+        }
+        out[width] = weighted * difference;
+    }
+
+    // Error Function e.g. SSE, each term scaled by the point's weight. Bit
+    // reproducible for any number of threads.
+    double error_function(std::vector<double>& theta, 
+                          std::vector<DataPoint>& data_points)
+    {
+        double sum = DeterministicReduction::sum(data_points.size(), [&](size_t i)
+        {
+            double diff_1 = _hypothesis_value(theta, data_points[i].getFeatures()) - data_points[i].getTarget(0);
+            return data_points[i].getWeight() * diff_1 * diff_1;
+        }, m_reduce_threads);
         return sum / 2.0;
     }
     
@@ -52,17 +112,67 @@ public:
     std::vector<double> error_function_derivative (DataPoint data_point, 
                                                    std::vector<double> theta)
     {
-        unsigned int number_of_features = data_point.getFeatures().size();
-        // Prepare vector of J_Theta derivatives for each feature
-        auto all_j_theta_derivs = std::vector<double>(number_of_features, 1.0);
-        std::vector<double> h_theta = this->hypothesis(theta, data_point.getFeatures());
-        double difference = h_theta[0] - data_point.getTarget(0);
-        for (unsigned int i = 0; i < number_of_features; i++)
+        unsigned int number_of_parameters = this->number_of_parameters(data_point.getFeatures().size());
+        // Prepare vector of J_Theta derivatives for each parameter
+        auto all_j_theta_derivs = std::vector<double>(number_of_parameters, 1.0);
+        double difference = _hypothesis_value(theta, data_point.getFeatures()) - data_point.getTarget(0);
+        _scaled_row(data_point.getFeatures(), data_point.getWeight() * difference, &all_j_theta_derivs[0]);
+        return all_j_theta_derivs;
+    }
+
+    // Loss and gradient share the residual, so one pass over the data. The
+    // squared residual is carried as an extra component of the reduction.
+    double error_and_gradient(std::vector<double>& theta,
+                              std::vector<DataPoint>& data_points,
+                              std::vector<double>& gradient)
+    {
+        unsigned int width = theta.size();
+        std::vector<double> sums;
+        DeterministicReduction::sum_vector(data_points.size(), width + 1, [&](size_t i, double* out)
         {
-            double j_theta_deriv = difference * data_point.getFeature(i);
-            all_j_theta_derivs[i] = j_theta_deriv;
+            std::vector<double>& features = data_points[i].getFeatures();
+            if(!m_transform)
+            {
+                row_terms(&features[0], width, &theta[0], data_points[i].getTarget(0),
+                          data_points[i].getWeight(), out);
+                return;
+            }
+            double difference = _hypothesis_value(theta, features) - data_points[i].getTarget(0);
+            double weighted = data_points[i].getWeight() * difference;
+            _scaled_row(features, weighted, out);
+            out[width] = weighted * difference;
+        }, sums, m_reduce_threads);
+        gradient.assign(sums.begin(), sums.begin() + width);
+        return sums[width] / 2.0;
+    }
+
+    // Weight times (hypothesis minus target)
+    double residual(std::vector<double>& theta, DataPoint& data_point)
+    {
+        return data_point.getWeight() * (_hypothesis_value(theta, data_point.getFeatures()) - data_point.getTarget(0));
+    }
+
+    // out += scale * [features, derived(features)], only touching non-zero entries
+    void add_scaled_row(DataPoint& data_point, double scale, std::vector<double>& out)
+    {
+        std::vector<double>& features = data_point.getFeatures();
+        for (unsigned int j = 0; j < features.size(); j++)
+        {
+            out[j] += scale * features[j];
         }
-        return all_j_theta_derivs;
+        if(m_transform)
+        {
+            m_transform->for_each_derived(features, [&out, scale](unsigned int i, double value)
+            {
+                out[i] += scale * value;
+            });
+        }
+    }
+
+    // Raw features plus any derived features
+    unsigned int number_of_parameters(unsigned int number_of_features)
+    {
+        return m_transform ? m_transform->number_of_parameters(number_of_features) : number_of_features;
     }
 
     // Add a pointer to the params
@@ -73,6 +183,11 @@ public:
         {
             const double a = params->get<double>( "mesh.a" );
             std::cout << "Mesh A is: " << a << std::endl;
+            m_transform = FeatureTransform::from_params(params);
+            if(params->has("optimisation.reduce.threads"))
+            {
+                m_reduce_threads = params->get<unsigned int>("optimisation.reduce.threads");
+            }
         }else{
             std::cout << "Null pointer" << std::endl;
         }
@@ -4,6 +4,7 @@
 #include <vector>
 #include <limits>
 #include <utility>
+#include <iostream>
 
 #include "datapoint.h"
 
@@ -23,7 +24,7 @@ public:
         
         // Get the min/max for target
         double min = std::numeric_limits<double>::max();
-        double max = std::numeric_limits<double>::min();
+        double max = std::numeric_limits<double>::lowest();
 
         for(auto ex: examples)
         {
@@ -95,6 +96,12 @@ public:
         return ((data_point - min) / (max - min));
     }
 
+    // Maps a normalised value back to the original scale
+    static double denormaliseDataPoint(double data_point, double max, double min)
+    {
+        return (data_point * (max - min)) + min;
+    }
+
 private:
 
 };
@@ -0,0 +1,139 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// CPU affinity
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+
+// NUMA layout read from sysfs, without libnuma. Machines (or containers)
+// without /sys/devices/system/node are reported as a single node holding
+// every CPU this process may run on.
+class NumaTopology
+{
+private:
+    // CPUs of each node, restricted to the process affinity mask
+    std::vector<std::vector<int>> m_node_cpus;
+
+    // Parses a cpulist such as "0-3,8-11"
+    static std::vector<int> _parse_cpu_list(const std::string& list)
+    {
+        std::vector<int> cpus;
+        std::istringstream is_list(list);
+        std::string range;
+        while(std::getline(is_list, range, ','))
+        {
+            if(range.empty() || range == "\n")
+            {
+                continue;
+            }
+            int first = 0;
+            int last = 0;
+            char dash = 0;
+            std::istringstream is_range(range);
+            is_range >> first;
+            last = first;
+            if(is_range >> dash && dash == '-')
+            {
+                is_range >> last;
+            }
+            for(int cpu = first; cpu <= last; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+public:
+    explicit NumaTopology()
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+
+        std::vector<int> node_ids;
+        DIR* dir = opendir("/sys/devices/system/node");
+        if(dir != nullptr)
+        {
+            while(dirent* entry = readdir(dir))
+            {
+                std::string name(entry->d_name);
+                if(name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                   name.find_first_not_of("0123456789", 4) == std::string::npos)
+                {
+                    node_ids.push_back(std::stoi(name.substr(4)));
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(node_ids.begin(), node_ids.end());
+
+        for(auto node: node_ids)
+        {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            std::vector<int> cpus;
+            for(auto cpu: _parse_cpu_list(list))
+            {
+                if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            if(!cpus.empty())
+            {
+                m_node_cpus.push_back(cpus);
+            }
+        }
+
+        // Single node fallback
+        if(m_node_cpus.empty())
+        {
+            std::vector<int> cpus;
+            for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            {
+                if(CPU_ISSET(cpu, &allowed))
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            if(cpus.empty())
+            {
+                cpus.push_back(0);
+            }
+            m_node_cpus.push_back(cpus);
+        }
+    }
+
+    unsigned int number_of_nodes() const
+    {
+        return m_node_cpus.size();
+    }
+
+    const std::vector<int>& cpus(unsigned int node) const
+    {
+        return m_node_cpus.at(node);
+    }
+
+    // Restrict the calling thread to the given CPUs, returns false on failure
+    static bool pin_current_thread(const std::vector<int>& cpus)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(auto cpu: cpus)
+        {
+            CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+};
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef NUMA_GRADIENT_H
+#define NUMA_GRADIENT_H
+
+// std::setprecision
+#include <iomanip>
+#include <limits>
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <memory>
+#include <algorithm>
+
+// input parameters
+#include "parameter.hh"
+
+// Optimisation datapoint
+#include "datapoint.h"
+#include "linearerrorfunction.h"
+
+// Topology and pinning
+#include "numa.h"
+
+// Reproducible block sums
+#include "reduction.h"
+
+// Line searches and schedules, budgets
+#include "stepsize.h"
+#include "trainingcontrol.h"
+#include "convergence.h"
+
+// Full batch gradient descent for multi-socket hosts. Worker threads are
+// pinned to the cores of each NUMA node and copy their shard of the data
+// themselves, so first-touch places it in node local memory. Each node keeps
+// its own replica of theta, refreshed at every batch boundary.
+//
+// Shards are whole DeterministicReduction blocks, so the loss and gradient
+// are bit identical to LinearErrorFunction::error_and_gradient whatever the
+// number of nodes or threads, as long as there is a full block per worker.
+// Smaller data is cut into rows/ workers blocks so every worker has a share;
+// results are then still reproducible for a given number of workers.
+class NumaGradientDescent
+{
+    private:
+
+        struct Worker
+        {
+            unsigned int node;
+            int cpu;
+            size_t first_block;
+            size_t last_block;
+            size_t first_row;
+            size_t last_row;
+
+            // Node local copies of the shard, row major
+            std::vector<double> features;
+            std::vector<double> targets;
+            std::vector<double> weights;
+
+            double busy_seconds = 0.0;
+        };
+
+        std::vector<double> m_theta;
+        std::shared_ptr<ConfigParameters> m_config_params = nullptr;
+
+        unsigned int number_of_training_points;
+        unsigned int number_of_features;
+
+        NumaTopology m_topology;
+        std::vector<Worker> m_workers;
+        std::vector<std::thread> m_threads;
+
+        // One theta replica per node, allocated by a thread on that node
+        std::vector<std::vector<double>> m_node_theta;
+
+        // Rows per block and loss and gradient partials, (d + 1) per block
+        size_t m_block_size = DeterministicReduction::block_size;
+        size_t m_blocks = 0;
+        std::vector<double> m_partials;
+
+        // Work hand-off between the coordinator and the workers
+        std::mutex m_mutex;
+        std::condition_variable m_start_condition;
+        std::condition_variable m_done_condition;
+        unsigned long m_generation = 0;
+        unsigned int m_pending = 0;
+        bool m_stopping = false;
+
+        // Reporting
+        double m_pass_seconds = 0.0;
+        unsigned long m_passes = 0;
+
+        TrainingControl m_control;
+
+        void _worker(unsigned int index, const std::vector<DataPoint>* data_points)
+        {
+            Worker& worker = m_workers[index];
+            std::vector<int> cpus(1, worker.cpu);
+            NumaTopology::pin_current_thread(cpus);
+
+            // First touch: the shard and the node's theta replica are written
+            // by a thread already running on the node
+            unsigned int width = number_of_features;
+            worker.features.resize((worker.last_row - worker.first_row) * width);
+            worker.targets.resize(worker.last_row - worker.first_row);
+            worker.weights.resize(worker.last_row - worker.first_row);
+            for(size_t i = worker.first_row; i < worker.last_row; i++)
+            {
+                DataPoint data_point = (*data_points)[i];
+                for(unsigned int j = 0; j < width; j++)
+                {
+                    worker.features[(i - worker.first_row) * width + j] = data_point.getFeature(j);
+                }
+                worker.targets[i - worker.first_row] = data_point.getTarget(0);
+                worker.weights[i - worker.first_row] = data_point.getWeight();
+            }
+
+            unsigned long seen_generation = 0;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if(m_node_theta[worker.node].empty())
+                {
+                    m_node_theta[worker.node].assign(width, 0.0);
+                }
+                if(--m_pending == 0)
+                {
+                    m_done_condition.notify_one();
+                }
+            }
+
+            while(true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_start_condition.wait(lock, [this, seen_generation]()
+                    {
+                        return m_stopping || m_generation != seen_generation;
+                    });
+                    if(m_stopping)
+                    {
+                        return;
+                    }
+                    seen_generation = m_generation;
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                const std::vector<double>& theta = m_node_theta[worker.node];
+                const double* features = worker.features.empty() ? nullptr : &worker.features[0];
+                const double* targets = worker.targets.empty() ? nullptr : &worker.targets[0];
+                const double* weights = worker.weights.empty() ? nullptr : &worker.weights[0];
+                size_t first_row = worker.first_row;
+                auto term = [&theta, features, targets, weights, first_row, width](size_t i, double* out)
+                {
+                    LinearErrorFunction::row_terms(features + (i - first_row) * width, width, &theta[0],
+                                                   targets[i - first_row], weights[i - first_row], out);
+                };
+                DeterministicReduction::block_partials(number_of_training_points, width + 1, term,
+                                                       worker.first_block, worker.last_block,
+                                                       m_partials.empty() ? nullptr : &m_partials[0],
+                                                       m_block_size);
+                worker.busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if(--m_pending == 0)
+                {
+                    m_done_condition.notify_one();
+                }
+            }
+        }
+
+        void _stop_workers()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_start_condition.notify_all();
+            for(auto&& thread: m_threads)
+            {
+                thread.join();
+            }
+        }
+
+        // One parallel pass: loss and summed gradient at theta
+        double _evaluate(const std::vector<double>& theta, std::vector<double>& gradient)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            // Reconcile the replicas at the batch boundary
+            for(auto&& replica: m_node_theta)
+            {
+                replica = theta;
+            }
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_pending = m_workers.size();
+                m_generation++;
+            }
+            m_start_condition.notify_all();
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done_condition.wait(lock, [this]() { return m_pending == 0; });
+            }
+
+            std::vector<double> sums;
+            DeterministicReduction::combine(m_partials.empty() ? nullptr : &m_partials[0], m_blocks,
+                                            number_of_features + 1, sums);
+            gradient.assign(sums.begin(), sums.begin() + number_of_features);
+
+            m_pass_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            m_passes++;
+            return sums[number_of_features] / 2.0;
+        }
+
+    public:
+        explicit NumaGradientDescent(std::vector<DataPoint>& data_point_samples,
+                                     std::vector<double>& initial_theta,
+                                     std::shared_ptr<ConfigParameters> config_params = nullptr)
+        {
+            this->m_config_params = config_params;
+            if(config_params != nullptr && config_params->has("optimisation.features"))
+            {
+                throw std::string("optimisation.features is not supported by NumaGradientDescent");
+            }
+
+            number_of_features = 0;
+            number_of_training_points = data_point_samples.size();
+            if (number_of_training_points > 0)
+            {
+                number_of_features = data_point_samples[0].getFeatures().size();
+            }
+            m_theta = std::vector<double>(number_of_features, 1.0);
+            for(unsigned int i = 0; i < initial_theta.size() && i < m_theta.size(); i++)
+            {
+                m_theta[i] = initial_theta[i];
+            }
+            m_control.add_params(config_params);
+
+            // One worker per allowed core, optionally capped per node
+            unsigned int threads_per_node = std::numeric_limits<unsigned int>::max();
+            if(config_params != nullptr && config_params->has("optimisation.numa.threads_per_node"))
+            {
+                threads_per_node = config_params->get<unsigned int>("optimisation.numa.threads_per_node");
+            }
+            for(unsigned int node = 0; node < m_topology.number_of_nodes(); node++)
+            {
+                const std::vector<int>& cpus = m_topology.cpus(node);
+                for(unsigned int t = 0; t < cpus.size() && t < threads_per_node; t++)
+                {
+                    Worker worker = Worker();
+                    worker.node = node;
+                    worker.cpu = cpus[t];
+                    m_workers.push_back(worker);
+                }
+            }
+
+            // Whole blocks per worker, in node order. Blocks shrink below the
+            // reduction's size when there are fewer rows than that per worker.
+            size_t workers = std::max<size_t>(1, m_workers.size());
+            size_t rows_per_worker = (number_of_training_points + workers - 1) / workers;
+            m_block_size = std::max<size_t>(1, std::min(m_block_size, rows_per_worker));
+            m_blocks = DeterministicReduction::number_of_blocks(number_of_training_points, m_block_size);
+            for(unsigned int w = 0; w < m_workers.size(); w++)
+            {
+                Worker& worker = m_workers[w];
+                worker.first_block = m_blocks * w / m_workers.size();
+                worker.last_block = m_blocks * (w + 1) / m_workers.size();
+                worker.first_row = std::min<size_t>(worker.first_block * m_block_size, number_of_training_points);
+                worker.last_row = std::min<size_t>(worker.last_block * m_block_size, number_of_training_points);
+            }
+            m_partials.resize(m_blocks * (number_of_features + 1));
+            m_node_theta.resize(m_topology.number_of_nodes());
+
+            // Start the workers and wait for them to load their shards. If a
+            // thread can't be started, stop and join those that were, as the
+            // destructor won't run.
+            m_pending = m_workers.size();
+            try
+            {
+                for(unsigned int w = 0; w < m_workers.size(); w++)
+                {
+                    m_threads.push_back(std::thread(&NumaGradientDescent::_worker, this, w, &data_point_samples));
+                }
+            }
+            catch(...)
+            {
+                this->_stop_workers();
+                throw;
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done_condition.wait(lock, [this]() { return m_pending == 0; });
+        }
+
+        ~NumaGradientDescent()
+        {
+            this->_stop_workers();
+        }
+
+        // Same settings as GradientDescent in batch mode (optimisation.grad.step)
+        std::vector<double> run()
+        {
+            if(this->m_config_params == nullptr)
+            {
+                std::cout << "Warning: No parameters passed, using base gradient descent settings." << std::endl;
+            }
+            DescentSettings settings(m_config_params);
+            ConvergenceCheck convergence(m_config_params);
+
+            std::shared_ptr<BatchStepSize> step_size =
+                StepSizeFactory::make_batch_step(m_config_params, settings.alpha, settings.adaptive_learning_rate);
+            BatchEvaluation evaluate = [this](const std::vector<double>& theta, std::vector<double>& gradient)
+            {
+                return this->_evaluate(theta, gradient);
+            };
+
+            m_control.start();
+            std::vector<double> gradient;
+            double current_error = evaluate(m_theta, gradient);
+            bool converge = false;
+            unsigned int number_of_iterations = 0;
+            while (!converge && !m_control.should_stop(number_of_iterations))
+            {
+                if(number_of_iterations % settings.print_err_modulo == 0)
+                {
+                    int precision = std::numeric_limits<double>::max_digits10;
+                    std::cout << std::setprecision(precision) << "Error is: " << current_error << std::endl;
+                }
+                m_control.report(number_of_iterations, current_error, m_theta);
+
+                std::vector<double> newTheta;
+                std::vector<double> new_gradient;
+                double new_error;
+                step_size->step(m_theta, gradient, current_error, evaluate,
+                                newTheta, new_gradient, new_error);
+                if(step_size->stalled())
+                {
+                    std::cout << "Warning: line search found no decrease, stopping." << std::endl;
+                    m_control.stalled();
+                    break;
+                }
+
+                converge = convergence.converged(m_theta, newTheta, new_error, settings.eps);
+
+                m_theta = newTheta;
+                gradient = new_gradient;
+                current_error = new_error;
+                number_of_iterations++;
+            }
+            if(converge)
+            {
+                m_control.converged();
+            }
+
+            this->print_bandwidth_report();
+            return m_theta;
+        }
+
+        // Bytes of shard data scanned per node, over the wall time of the passes
+        void print_bandwidth_report()
+        {
+            std::streamsize precision = std::cout.precision(4);
+            for(unsigned int node = 0; node < m_topology.number_of_nodes(); node++)
+            {
+                unsigned int threads = 0;
+                size_t rows = 0;
+                double busy = 0.0;
+                for(auto&& worker: m_workers)
+                {
+                    if(worker.node == node)
+                    {
+                        threads++;
+                        rows += worker.last_row - worker.first_row;
+                        busy += worker.busy_seconds;
+                    }
+                }
+                double bytes = (double)rows * (number_of_features + 2) * sizeof(double) * m_passes;
+                std::cout << "Node " << node << ": " << threads << " threads, " << rows << " rows, "
+                          << (bytes / std::max(m_pass_seconds, 1e-12) / 1e9) << " GB/s ("
+                          << (bytes / std::max(busy / std::max(threads, 1u), 1e-12) / 1e9)
+                          << " GB/s while busy)" << std::endl;
+            }
+            std::cout.precision(precision);
+        }
+
+        StopReason stop_reason() const
+        {
+            return m_control.stop_reason();
+        }
+};
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef ONLINE_TRAINER_H
+#define ONLINE_TRAINER_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+// input parameters
+#include "parameter.hh"
+
+// Optimisation datapoint
+#include "datapoint.h"
+#include "linearerrorfunction.h"
+#include "normalisation.h"
+
+// Consistent view of an online model, usable with BatchScorer/ ModelFile
+struct OnlineSnapshot
+{
+    std::vector<double> theta;
+    std::pair<double, double> minMaxPair;
+    unsigned long rows_seen;
+};
+
+// Trains a linear model row by row from a stream. The min/ max normalisation
+// is maintained incrementally (as Normalisation::getMinMaxFromAllData would
+// compute over the rows so far), and each micro-batch applies one momentum
+// update, so the cost per row is constant.
+//
+// Rows are "feature_1 ... feature_n target", without the intercept column.
+class OnlineTrainer
+{
+    private:
+
+        // Normalised-space parameters, intercept first
+        std::vector<double> m_theta;
+        std::vector<double> m_velocity;
+
+        // Running min/ max of every value seen, before the +/- 1 padding
+        double m_min = std::numeric_limits<double>::max();
+        double m_max = -std::numeric_limits<double>::max();
+        std::pair<double, double> m_minMaxPair;
+
+        // Raw rows of the current micro-batch, with intercept column
+        std::vector<DataPoint> m_batch;
+        unsigned int m_batch_size = 1;
+
+        double m_alpha = 0.01;
+        double m_momentum_gamma = 0.9;
+        unsigned int m_poll_ms = 100;
+
+        unsigned int number_of_features;
+        unsigned long m_rows_seen = 0;
+
+        std::shared_ptr<ErrorFunction> m_err_func;
+
+        // Latest published snapshot, swapped atomically so readers never
+        // wait for ingestion
+        std::shared_ptr<const OnlineSnapshot> m_snapshot;
+
+        std::atomic<bool> m_stopping;
+
+        // Widen the range for a new value. The raw prediction is
+        //   theta . x + min * (1 - sum(theta))
+        // (see BatchScorer), so the intercept is adjusted to keep predictions
+        // unchanged when the padded min moves. Not possible with derived
+        // features, which then adapt through training.
+        void _update_range(const std::vector<double>& values)
+        {
+            double old_min = m_minMaxPair.first;
+            for(auto value: values)
+            {
+                auto result = Normalisation::getMinMaxFromTrainingExample(value, m_min, m_max);
+                m_min = result.first;
+                m_max = result.second;
+            }
+            std::pair<double, double> padded(m_min - 1, m_max + 1);
+            if(padded == m_minMaxPair)
+            {
+                return;
+            }
+
+            double new_min = padded.first;
+            bool linear = m_theta.size() == number_of_features + 1;
+            if(linear && m_rows_seen > 0 && std::fabs(1.0 - new_min) > 1e-12)
+            {
+                double rest = 0.0;
+                for(unsigned int j = 1; j < m_theta.size(); j++)
+                {
+                    rest += m_theta[j];
+                }
+                m_theta[0] = (m_theta[0] * (1.0 - old_min) + (old_min - new_min) * (1.0 - rest)) /
+                    (1.0 - new_min);
+            }
+            m_minMaxPair = padded;
+        }
+
+        // One momentum step on the mean gradient of the micro-batch, normalised
+        // with the current range
+        void _apply_batch()
+        {
+            double min = m_minMaxPair.first;
+            double max = m_minMaxPair.second;
+            std::vector<double> gradient(m_theta.size(), 0.0);
+            for(auto&& data_point: m_batch)
+            {
+                for(unsigned int j = 0; j < m_theta.size(); j++)
+                {
+                    data_point.setFeature(j, Normalisation::normaliseDataPoint(data_point.getFeature(j), max, min));
+                }
+                data_point.setTarget(0, Normalisation::normaliseDataPoint(data_point.getTarget(0), max, min));
+                auto all_j_theta_derivs = m_err_func->error_function_derivative(data_point, m_theta);
+                for(unsigned int j = 0; j < m_theta.size(); j++)
+                {
+                    gradient[j] += all_j_theta_derivs[j];
+                }
+            }
+            for(unsigned int j = 0; j < m_theta.size(); j++)
+            {
+                m_velocity[j] = m_momentum_gamma * m_velocity[j] + m_alpha * gradient[j] / m_batch.size();
+                m_theta[j] -= m_velocity[j];
+            }
+            m_batch.clear();
+            this->_publish();
+        }
+
+        void _publish()
+        {
+            std::shared_ptr<OnlineSnapshot> snapshot = std::make_shared<OnlineSnapshot>();
+            snapshot->theta = m_theta;
+            snapshot->minMaxPair = m_minMaxPair;
+            snapshot->rows_seen = m_rows_seen;
+            std::atomic_store(&m_snapshot, std::shared_ptr<const OnlineSnapshot>(snapshot));
+        }
+
+        void _add(std::vector<double>& features, double target)
+        {
+            std::vector<double> values(features);
+            values.push_back(target);
+            this->_update_range(values);
+            m_rows_seen++;
+
+            std::vector<double> targets(1, target);
+            m_batch.push_back(DataPoint(features, targets));
+            if(m_batch.size() >= m_batch_size)
+            {
+                this->_apply_batch();
+            }
+        }
+
+        // Parses "f_1 ... f_n target", returns false for blank lines
+        bool _parse(const std::string& line, std::vector<double>& features, double& target)
+        {
+            std::istringstream is_line(line);
+            features.assign(number_of_features + 1, 1.0);
+            for(unsigned int j = 0; j < number_of_features; j++)
+            {
+                if(!(is_line >> features[j + 1]))
+                {
+                    if(j == 0 && line.find_first_not_of(" \t\r") == std::string::npos)
+                    {
+                        return false;
+                    }
+                    throw "invalid online row: " + line;
+                }
+            }
+            if(!(is_line >> target))
+            {
+                throw "invalid online row: " + line;
+            }
+            return true;
+        }
+
+    public:
+        // number_of_features excludes the intercept, initial_theta includes it
+        explicit OnlineTrainer(unsigned int features,
+                               std::vector<double>& initial_theta,
+                               std::shared_ptr<ConfigParameters> config_params = nullptr)
+            : number_of_features(features), m_stopping(false)
+        {
+            m_err_func = std::shared_ptr<ErrorFunction>(new LinearErrorFunction());
+            m_err_func->add_params(config_params);
+
+            // Theta also covers any derived features
+            m_theta = std::vector<double>(m_err_func->number_of_parameters(number_of_features + 1), 1.0);
+            for(unsigned int i = 0; i < initial_theta.size() && i < m_theta.size(); i++)
+            {
+                m_theta[i] = initial_theta[i];
+            }
+            m_velocity = std::vector<double>(m_theta.size(), 0.0);
+            m_minMaxPair = std::make_pair(0.0, 1.0);
+
+            if(config_params != nullptr)
+            {
+                m_alpha = config_params->get<double>("optimisation.grad.alpha");
+                m_momentum_gamma = config_params->get<double>("optimisation.grad.momentum_gamma");
+                if(config_params->has("optimisation.online.batch_size"))
+                {
+                    m_batch_size = std::max(1u, config_params->get<unsigned int>("optimisation.online.batch_size"));
+                }
+                if(config_params->has("optimisation.online.poll_ms"))
+                {
+                    m_poll_ms = config_params->get<unsigned int>("optimisation.online.poll_ms");
+                }
+            }
+            else
+            {
+                std::cout << "Warning: No parameters passed, using base online settings." << std::endl;
+            }
+
+            this->_publish();
+        }
+
+        // Adds one row: raw features (without intercept) and target
+        void add_row(const std::vector<double>& raw_features, double target)
+        {
+            std::vector<double> features(number_of_features + 1, 1.0);
+            for(unsigned int j = 0; j < number_of_features; j++)
+            {
+                features[j + 1] = raw_features.at(j);
+            }
+            this->_add(features, target);
+        }
+
+        // Reads rows until the end of the stream. With follow, waits at the
+        // end for more data (a growing file or pipe) until stop() is called.
+        void ingest(std::istream& in, bool follow = false)
+        {
+            std::string pending;
+            std::string line;
+            std::vector<double> features;
+            double target = 0.0;
+            while(!m_stopping.load(std::memory_order_relaxed))
+            {
+                if(std::getline(in, line))
+                {
+                    if(in.eof())
+                    {
+                        // No newline yet, the writer may still be appending
+                        pending += line;
+                        if(!follow)
+                        {
+                            line = pending;
+                            pending.clear();
+                        }
+                        else
+                        {
+                            in.clear();
+                            continue;
+                        }
+                    }
+                    else if(!pending.empty())
+                    {
+                        line = pending + line;
+                        pending.clear();
+                    }
+                    if(this->_parse(line, features, target))
+                    {
+                        this->_add(features, target);
+                    }
+                    continue;
+                }
+                if(!follow)
+                {
+                    break;
+                }
+                in.clear();
+                std::this_thread::sleep_for(std::chrono::milliseconds(m_poll_ms));
+            }
+            if(!m_batch.empty())
+            {
+                this->_apply_batch();
+            }
+        }
+
+        // Ends a following ingest() after its current row, callable from any thread
+        void stop()
+        {
+            m_stopping.store(true, std::memory_order_relaxed);
+        }
+
+        // Latest consistent model, never blocks ingestion
+        std::shared_ptr<const OnlineSnapshot> snapshot() const
+        {
+            return std::atomic_load(&m_snapshot);
+        }
+};
+
+#endif
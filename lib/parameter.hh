@@ -96,6 +96,14 @@ public:
     }
 
 
+  /**
+   * \brief whether a parameter with key has been set
+   */
+    bool has( const std::string& key ) const
+    {
+        return data_.find( key ) != data_.end();
+    }
+
     std::string getString( const std::string& key ) const
     {
         // get value from data
@@ -0,0 +1,203 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+
+// Reproducible summation. Terms are grouped into fixed size blocks, each block
+// is summed with compensated (Kahan) summation over a fixed number of lanes,
+// and the block partials are combined with a fixed pairwise tree. The order of
+// every addition depends only on the number of terms, so results are bit
+// identical whatever the thread count or the SIMD width of the machine.
+//
+// Must not be compiled with -ffast-math, which allows reassociation. Build
+// with -ffp-contract=off too when results must match across CPUs with and
+// without FMA, as contraction changes the terms themselves.
+class DeterministicReduction
+{
+public:
+
+    // Terms per block and interleaved accumulators per block
+    static const size_t block_size = 1024;
+    static const unsigned int lanes = 4;
+
+    // Sum of term(i) for i in [0, n)
+    template<class Term>
+    static double sum(size_t n, Term term, unsigned int threads = 1)
+    {
+        std::vector<double> result(1, 0.0);
+        sum_vector(n, 1, [&term](size_t i, double* out) { out[0] = term(i); }, result, threads);
+        return result[0];
+    }
+
+    // Element-wise sum of width-long terms, term(i, out) writes term i to out
+    template<class Term>
+    static void sum_vector(size_t n, unsigned int width, Term term,
+                           std::vector<double>& result, unsigned int threads = 1)
+    {
+        result.assign(width, 0.0);
+        size_t blocks = number_of_blocks(n);
+        if(blocks == 0)
+        {
+            return;
+        }
+
+        // Any assignment of blocks to threads gives the same partials
+        std::vector<double> partials(blocks * width);
+        threads = std::max(1u, std::min<unsigned int>(threads, blocks));
+        if(threads == 1)
+        {
+            block_partials(n, width, term, 0, blocks, &partials[0]);
+        }
+        else
+        {
+            std::vector<std::thread> workers;
+            for(unsigned int t = 0; t < threads; t++)
+            {
+                size_t first = blocks * t / threads;
+                size_t last = blocks * (t + 1) / threads;
+                workers.push_back(std::thread([n, width, &term, first, last, &partials]()
+                {
+                    block_partials(n, width, term, first, last, &partials[0]);
+                }));
+            }
+            for(auto&& worker: workers)
+            {
+                worker.join();
+            }
+        }
+
+        combine(&partials[0], blocks, width, result);
+    }
+
+    // Building blocks for callers that schedule the blocks themselves: any
+    // split of the blocks gives the same result as sum_vector. A smaller
+    // size (rows per block) gives results that are just as reproducible, but
+    // only equal to sum_vector's for the default.
+
+    static size_t number_of_blocks(size_t n, size_t size = block_size)
+    {
+        return (n + size - 1) / size;
+    }
+
+    // Kahan sum of each block in [first, last), lanes hold interleaved terms.
+    // Writes width values per block at partials + block * width.
+    template<class Term>
+    static void block_partials(size_t n, unsigned int width, Term& term,
+                               size_t first, size_t last, double* partials,
+                               size_t size = block_size)
+    {
+        std::vector<double> sums(width * lanes);
+        std::vector<double> compensations(width * lanes);
+        std::vector<double> value(width);
+        for(size_t block = first; block < last; block++)
+        {
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(compensations.begin(), compensations.end(), 0.0);
+            size_t begin = block * size;
+            size_t end = std::min(n, begin + size);
+            for(size_t i = begin; i < end; i++)
+            {
+                term(i, &value[0]);
+                size_t lane = ((i - begin) % lanes) * width;
+                for(unsigned int k = 0; k < width; k++)
+                {
+                    double y = value[k] - compensations[lane + k];
+                    double t = sums[lane + k] + y;
+                    compensations[lane + k] = (t - sums[lane + k]) - y;
+                    sums[lane + k] = t;
+                }
+            }
+            // Fixed pairwise combination of the lanes, (0 + 1) + (2 + 3) for four
+            for(unsigned int k = 0; k < width; k++)
+            {
+                partials[block * width + k] = _tree(&sums[0], width, k, 0, lanes);
+            }
+        }
+    }
+
+    // Pairwise tree over all block partials
+    static void combine(const double* partials, size_t number_of_blocks, unsigned int width,
+                        std::vector<double>& result)
+    {
+        result.assign(width, 0.0);
+        for(unsigned int k = 0; number_of_blocks > 0 && k < width; k++)
+        {
+            result[k] = _tree(partials, width, k, 0, number_of_blocks);
+        }
+    }
+
+    // The tree's shape over a range depends only on its length, so combine()
+    // over the partials of one of these subtrees gives that node's value.
+    // Roots of the tree levels deep (or shallower leaves), in block order, as
+    // [first, last) block ranges. There are at most 2^levels of them.
+    static std::vector<std::pair<size_t, size_t>> subtrees(size_t number_of_blocks, unsigned int levels)
+    {
+        std::vector<std::pair<size_t, size_t>> roots;
+        if(number_of_blocks > 0)
+        {
+            _subtrees(0, number_of_blocks, levels, roots);
+        }
+        return roots;
+    }
+
+    // Combines the values of the subtrees(number_of_blocks, levels) roots,
+    // width per root in their order, over the top levels of the tree. Gives
+    // the same bits as combine() over all the block partials.
+    static void combine_subtrees(const double* values, size_t number_of_blocks, unsigned int levels,
+                                 unsigned int width, std::vector<double>& result)
+    {
+        result.assign(width, 0.0);
+        for(unsigned int k = 0; number_of_blocks > 0 && k < width; k++)
+        {
+            size_t root = 0;
+            result[k] = _top(values, width, k, 0, number_of_blocks, levels, root);
+        }
+    }
+
+private:
+
+    static void _subtrees(size_t first, size_t last, unsigned int levels,
+                          std::vector<std::pair<size_t, size_t>>& roots)
+    {
+        if(levels == 0 || last - first == 1)
+        {
+            roots.push_back(std::make_pair(first, last));
+            return;
+        }
+        size_t middle = first + (last - first) / 2;
+        _subtrees(first, middle, levels - 1, roots);
+        _subtrees(middle, last, levels - 1, roots);
+    }
+
+    // As _tree, reading the next root's value once levels run out
+    static double _top(const double* values, unsigned int width, unsigned int k,
+                       size_t first, size_t last, unsigned int levels, size_t& root)
+    {
+        if(levels == 0 || last - first == 1)
+        {
+            return values[(root++) * width + k];
+        }
+        size_t middle = first + (last - first) / 2;
+        double left = _top(values, width, k, first, middle, levels - 1, root);
+        double right = _top(values, width, k, middle, last, levels - 1, root);
+        return left + right;
+    }
+
+    // Pairwise sum of component k over blocks (or lanes) [first, last)
+    static double _tree(const double* partials, unsigned int width, unsigned int k,
+                        size_t first, size_t last)
+    {
+        if(last - first == 1)
+        {
+            return partials[first * width + k];
+        }
+        size_t middle = first + (last - first) / 2;
+        return _tree(partials, width, k, first, middle) + _tree(partials, width, k, middle, last);
+    }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+// Prefix sums over non-negative scores with O(log N) update and O(log N)
+// draws in proportion to the scores
+class FenwickTree
+{
+private:
+    std::vector<double> m_tree;
+    std::vector<double> m_scores;
+    unsigned int m_top_bit = 0;
+
+public:
+    explicit FenwickTree(unsigned int size = 0)
+    {
+        this->assign(std::vector<double>(size, 0.0));
+    }
+
+    // Rebuild from scratch in O(N), which also clears accumulated rounding
+    void assign(const std::vector<double>& scores)
+    {
+        m_scores = scores;
+        m_tree.assign(scores.size() + 1, 0.0);
+        for(unsigned int i = 1; i <= scores.size(); i++)
+        {
+            m_tree[i] += scores[i - 1];
+            unsigned int parent = i + (i & (~i + 1));
+            if(parent <= scores.size())
+            {
+                m_tree[parent] += m_tree[i];
+            }
+        }
+        m_top_bit = 1;
+        while(m_top_bit * 2 <= scores.size())
+        {
+            m_top_bit *= 2;
+        }
+    }
+
+    unsigned int size() const
+    {
+        return m_scores.size();
+    }
+
+    double score(unsigned int i) const
+    {
+        return m_scores[i];
+    }
+
+    void set(unsigned int i, double score)
+    {
+        double delta = score - m_scores[i];
+        m_scores[i] = score;
+        for(unsigned int k = i + 1; k < m_tree.size(); k += k & (~k + 1))
+        {
+            m_tree[k] += delta;
+        }
+    }
+
+    double total() const
+    {
+        double sum = 0.0;
+        for(unsigned int k = m_scores.size(); k > 0; k -= k & (~k + 1))
+        {
+            sum += m_tree[k];
+        }
+        return sum;
+    }
+
+    // Smallest i with score(0) + ... + score(i) > target
+    unsigned int find(double target) const
+    {
+        unsigned int position = 0;
+        for(unsigned int bit = m_top_bit; bit > 0 && !m_scores.empty(); bit /= 2)
+        {
+            unsigned int next = position + bit;
+            if(next < m_tree.size() && m_tree[next] <= target)
+            {
+                position = next;
+                target -= m_tree[next];
+            }
+        }
+        return std::min<unsigned int>(position, m_scores.size() - 1);
+    }
+};
+
+// Draws rows in proportion to a score, mixed with uniform draws so every row
+// keeps a chance of being visited:
+//   p_i = (1 - mix) score_i / sum(scores) + mix / N
+// Each draw also returns 1 / (N p_i), the weight that keeps the sampled
+// gradient an unbiased estimate of the mean gradient. mix is kept at 0.001 or
+// more, so a row whose score is 0 is still drawn now and then and its weight
+// stays below 1 / mix rather than infinite.
+class ImportanceSampler
+{
+private:
+    FenwickTree m_tree;
+    double m_mix;
+    std::mt19937 m_generator;
+    std::uniform_real_distribution<double> m_unit;
+
+public:
+    explicit ImportanceSampler(const std::vector<double>& scores, double mix = 0.1, unsigned int seed = 1)
+        : m_tree(0),
+          m_mix(std::min(std::max(mix, 0.001), 1.0)),
+          m_generator(seed),
+          m_unit(0.0, 1.0)
+    {
+        m_tree.assign(scores);
+    }
+
+    unsigned int sample(double& reweight)
+    {
+        unsigned int n = m_tree.size();
+        double total = m_tree.total();
+        unsigned int row;
+        if(!(total > 0.0) || m_unit(m_generator) < m_mix)
+        {
+            row = std::min<unsigned int>(m_unit(m_generator) * n, n - 1);
+        }
+        else
+        {
+            row = m_tree.find(m_unit(m_generator) * total);
+        }
+        double probability = (total > 0.0) ?
+            (1.0 - m_mix) * m_tree.score(row) / total + m_mix / n : 1.0 / n;
+        reweight = 1.0 / (n * probability);
+        return row;
+    }
+
+    // Latest score of a row, e.g. its gradient norm when last visited
+    void update(unsigned int row, double score)
+    {
+        m_tree.set(row, std::max(score, 0.0));
+    }
+
+    // Rebuilds the tree from the current scores
+    void refresh()
+    {
+        std::vector<double> scores(m_tree.size());
+        for(unsigned int i = 0; i < scores.size(); i++)
+        {
+            scores[i] = m_tree.score(i);
+        }
+        m_tree.assign(scores);
+    }
+};
+
+#endif
@@ -0,0 +1,396 @@
+#ifndef SCORING_H
+#define SCORING_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <utility>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Normalise/ denormalise predictions
+#include "normalisation.h"
+
+// Reads and writes a trained linear model: the min/ max pair used for
+// normalisation followed by the theta values
+class ModelFile
+{
+public:
+
+    static void save(const std::string& path,
+                     const std::vector<double>& theta,
+                     std::pair<double, double> minMaxPair)
+    {
+        std::ofstream file(path.c_str());
+        if(!file.is_open())
+        {
+            throw "unable to write model file: " + path;
+        }
+        file.precision(17);
+        file << minMaxPair.first << " " << minMaxPair.second << std::endl;
+        file << theta.size() << std::endl;
+        for(unsigned int i = 0; i < theta.size(); i++)
+        {
+            file << theta[i] << (i != theta.size() - 1 ? " " : "");
+        }
+        file << std::endl;
+        file.close();
+        if(!file)
+        {
+            throw "unable to write model file: " + path;
+        }
+    }
+
+    static std::vector<double> load(const std::string& path,
+                                    std::pair<double, double>& minMaxPair)
+    {
+        std::ifstream file(path.c_str());
+        if(!file.is_open())
+        {
+            throw "unable to open model file: " + path;
+        }
+        unsigned int size = 0;
+        file >> minMaxPair.first >> minMaxPair.second >> size;
+        std::vector<double> theta(size, 0.0);
+        for(unsigned int i = 0; i < size; i++)
+        {
+            file >> theta[i];
+        }
+        if(!file || size == 0)
+        {
+            throw "invalid model file: " + path;
+        }
+        return theta;
+    }
+};
+
+// Applies a trained linear model to large inputs in fixed size chunks.
+//
+// Input rows hold the raw features without the intercept column, either as
+// whitespace separated text (one row per line) or as native doubles.
+// Memory use is bounded by the chunk size, whatever the size of the input.
+// Only plain linear models fold this way. The model file does not record
+// optimisation.features, so models trained with derived features can't be
+// scored from it.
+class BatchScorer
+{
+private:
+
+    // The normalisation is affine and the same for every column, so
+    //   denorm(theta . norm(x)) = theta . x + min * (1 - sum(theta))
+    // and the model folds into raw feature weights plus one offset
+    std::vector<double> m_weights;
+    double m_offset;
+
+    unsigned int m_number_of_features;
+    unsigned int m_threads;
+    size_t m_chunk_bytes;
+
+    // Rows are transposed into columns of this many rows before scoring
+    static const unsigned int block_rows = 1024;
+
+    // Output rows kept per thread, in order
+    struct Slice
+    {
+        std::string output;
+        std::string error;
+        size_t rows = 0;
+
+        // Text lines read, the failing one when error is set
+        size_t lines = 0;
+    };
+
+    // out[i] = offset + sum_j w_j * columns[j][i], contiguous in i so the
+    // inner loop vectorises
+    void _score_block(const double* columns, unsigned int rows, double* out) const
+    {
+        for(unsigned int i = 0; i < rows; i++)
+        {
+            out[i] = m_offset;
+        }
+        for(unsigned int j = 0; j < m_number_of_features; j++)
+        {
+            const double w = m_weights[j];
+            const double* column = columns + (size_t)j * block_rows;
+            for(unsigned int i = 0; i < rows; i++)
+            {
+                out[i] += w * column[i];
+            }
+        }
+    }
+
+    static void _append(std::string& output, const double* predictions,
+                        unsigned int rows, bool binary_output)
+    {
+        if(binary_output)
+        {
+            output.append(reinterpret_cast<const char*>(predictions), rows * sizeof(double));
+            return;
+        }
+        char text[32];
+        for(unsigned int i = 0; i < rows; i++)
+        {
+            int n = std::snprintf(text, sizeof(text), "%.17g\n", predictions[i]);
+            output.append(text, n);
+        }
+    }
+
+    // Parses and scores whole lines in [begin, end)
+    void _score_text(const char* begin, const char* end, bool binary_output, Slice& slice) const
+    {
+        std::vector<double> columns((size_t)m_number_of_features * block_rows);
+        std::vector<double> predictions(block_rows);
+        std::string line;
+        unsigned int rows = 0;
+
+        const char* p = begin;
+        while(p < end)
+        {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if(eol == nullptr)
+            {
+                eol = end;
+            }
+            // strtod needs a terminated string
+            line.assign(p, eol);
+            p = eol + 1;
+            slice.lines++;
+
+            const char* cursor = line.c_str();
+            char* next = nullptr;
+            unsigned int j = 0;
+            for(; j < m_number_of_features; j++)
+            {
+                double value = std::strtod(cursor, &next);
+                if(next == cursor)
+                {
+                    break;
+                }
+                columns[(size_t)j * block_rows + rows] = value;
+                cursor = next;
+            }
+            if(j == 0 && line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                // Blank line
+                continue;
+            }
+            if(j != m_number_of_features ||
+               line.find_first_not_of(" \t\r", cursor - line.c_str()) != std::string::npos)
+            {
+                slice.error = "expected " + std::to_string(m_number_of_features) +
+                    " features per row, got: " + line;
+                return;
+            }
+
+            if(++rows == block_rows)
+            {
+                this->_score_block(&columns[0], rows, &predictions[0]);
+                _append(slice.output, &predictions[0], rows, binary_output);
+                slice.rows += rows;
+                rows = 0;
+            }
+        }
+        if(rows > 0)
+        {
+            this->_score_block(&columns[0], rows, &predictions[0]);
+            _append(slice.output, &predictions[0], rows, binary_output);
+            slice.rows += rows;
+        }
+    }
+
+    // Scores row-major native doubles
+    void _score_binary(const double* rows_data, size_t number_of_rows,
+                       bool binary_output, Slice& slice) const
+    {
+        std::vector<double> columns((size_t)m_number_of_features * block_rows);
+        std::vector<double> predictions(block_rows);
+        for(size_t first = 0; first < number_of_rows; first += block_rows)
+        {
+            unsigned int rows = std::min<size_t>(block_rows, number_of_rows - first);
+            const double* row = rows_data + first * m_number_of_features;
+            for(unsigned int i = 0; i < rows; i++, row += m_number_of_features)
+            {
+                for(unsigned int j = 0; j < m_number_of_features; j++)
+                {
+                    columns[(size_t)j * block_rows + i] = row[j];
+                }
+            }
+            this->_score_block(&columns[0], rows, &predictions[0]);
+            _append(slice.output, &predictions[0], rows, binary_output);
+            slice.rows += rows;
+        }
+    }
+
+    // Writes the slices in order, returns the number of rows. lines counts
+    // the text lines of the input so far.
+    static size_t _flush(std::vector<Slice>& slices, std::ostream& out, size_t& lines)
+    {
+        size_t rows = 0;
+        for(auto&& slice: slices)
+        {
+            if(!slice.error.empty())
+            {
+                throw "line " + std::to_string(lines + slice.lines) + ": " + slice.error;
+            }
+            out.write(slice.output.data(), slice.output.size());
+            rows += slice.rows;
+            lines += slice.lines;
+        }
+        return rows;
+    }
+
+public:
+
+    // theta includes the intercept term, as returned by GradientDescent::run
+    explicit BatchScorer(const std::vector<double>& theta,
+                         std::pair<double, double> minMaxPair,
+                         unsigned int threads = 0,
+                         size_t chunk_bytes = 16 << 20)
+    {
+        if(theta.empty())
+        {
+            throw std::string("model has no parameters");
+        }
+        double min = minMaxPair.first;
+        double theta_sum = 0.0;
+        for(auto t: theta)
+        {
+            theta_sum += t;
+        }
+        m_offset = theta[0] + min * (1.0 - theta_sum);
+        m_weights = std::vector<double>(theta.begin() + 1, theta.end());
+        m_number_of_features = m_weights.size();
+
+        m_threads = (threads != 0) ? threads : std::max(1u, std::thread::hardware_concurrency());
+        m_chunk_bytes = std::max<size_t>(chunk_bytes, sizeof(double) * (m_number_of_features + 1));
+    }
+
+    unsigned int number_of_features() const
+    {
+        return m_number_of_features;
+    }
+
+    // Scores one row of raw features (without the intercept)
+    double score(const std::vector<double>& raw_features) const
+    {
+        double sum = m_offset;
+        for(unsigned int j = 0; j < m_number_of_features; j++)
+        {
+            sum += m_weights[j] * raw_features.at(j);
+        }
+        return sum;
+    }
+
+    // Streams all of in through the model, writing one prediction per row to
+    // out (text, or native doubles when binary_output). Returns the row count.
+    size_t score_stream(std::istream& in, std::ostream& out,
+                        bool binary_input, bool binary_output) const
+    {
+        std::vector<char> buffer(m_chunk_bytes);
+        std::vector<Slice> slices;
+        std::vector<std::thread> workers;
+        size_t total_rows = 0;
+        size_t total_lines = 0;
+        size_t carry = 0;
+        size_t row_bytes = sizeof(double) * m_number_of_features;
+
+        while(true)
+        {
+            in.read(&buffer[0] + carry, buffer.size() - carry);
+            size_t available = carry + in.gcount();
+            bool at_end = !in;
+            if(available == 0)
+            {
+                break;
+            }
+
+            // Only hand whole rows to the workers
+            size_t usable = available;
+            if(binary_input)
+            {
+                usable -= available % row_bytes;
+                if(at_end && usable != available)
+                {
+                    throw std::string("binary input ends with a partial row");
+                }
+            }
+            else if(!at_end)
+            {
+                const char* last = &buffer[0];
+                for(size_t i = available; i > 0; i--)
+                {
+                    if(buffer[i - 1] == '\n')
+                    {
+                        last = &buffer[i];
+                        break;
+                    }
+                }
+                usable = last - &buffer[0];
+                if(usable == 0)
+                {
+                    throw std::string("input line longer than the scoring chunk size");
+                }
+            }
+
+            // Split the chunk between the threads on row boundaries
+            slices.assign(m_threads, Slice());
+            workers.clear();
+            const char* begin = &buffer[0];
+            const char* end = begin + usable;
+            for(unsigned int t = 0; t < m_threads && begin < end; t++)
+            {
+                const char* split = end;
+                if(t != m_threads - 1)
+                {
+                    size_t share = (end - begin) / (m_threads - t);
+                    if(binary_input)
+                    {
+                        split = begin + share - share % row_bytes;
+                    }
+                    else
+                    {
+                        split = static_cast<const char*>(std::memchr(begin + share, '\n', end - begin - share));
+                        split = (split == nullptr) ? end : split + 1;
+                    }
+                }
+                Slice& slice = slices[t];
+                if(binary_input)
+                {
+                    const double* rows_data = reinterpret_cast<const double*>(begin);
+                    size_t number_of_rows = (split - begin) / row_bytes;
+                    workers.push_back(std::thread([this, rows_data, number_of_rows, binary_output, &slice]()
+                    {
+                        this->_score_binary(rows_data, number_of_rows, binary_output, slice);
+                    }));
+                }
+                else
+                {
+                    workers.push_back(std::thread([this, begin, split, binary_output, &slice]()
+                    {
+                        this->_score_text(begin, split, binary_output, slice);
+                    }));
+                }
+                begin = split;
+            }
+            for(auto&& worker: workers)
+            {
+                worker.join();
+            }
+            total_rows += _flush(slices, out, total_lines);
+
+            carry = available - usable;
+            std::memmove(&buffer[0], &buffer[0] + usable, carry);
+            if(at_end)
+            {
+                break;
+            }
+        }
+        return total_rows;
+    }
+};
+
+#endif
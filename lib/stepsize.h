@@ -0,0 +1,422 @@
+#ifndef STEPSIZE_H
+#define STEPSIZE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cmath>
+#include <functional>
+#include <algorithm>
+#include <limits>
+
+// input parameters
+#include "parameter.hh"
+
+// Learning rate for stochastic descent, queried once per epoch
+class LearningRateSchedule
+{
+public:
+    virtual ~LearningRateSchedule(){}
+
+    // Rate for the coming epoch, given the full error at the current theta
+    virtual double rate(unsigned int epoch, double current_error) = 0;
+};
+
+// Original heuristic: grow alpha while the error falls, shrink it otherwise
+class AdaptiveSchedule : public LearningRateSchedule
+{
+private:
+    double m_alpha;
+    float m_adaptive_learning_rate;
+    double m_previous_error = std::numeric_limits<double>::max();
+
+public:
+    explicit AdaptiveSchedule(double alpha, float adaptive_learning_rate)
+        : m_alpha(alpha), m_adaptive_learning_rate(adaptive_learning_rate){}
+
+    double rate(unsigned int, double current_error)
+    {
+        if(m_previous_error > current_error)
+        {
+            // If the error is reducing accelerate learning rate
+            m_alpha *= (1 + m_adaptive_learning_rate);
+        }
+        else
+        {
+            // If the error is increasing or stationary, reduce learning rate
+            m_alpha *= (1 - m_adaptive_learning_rate);
+        }
+        m_previous_error = current_error;
+        return m_alpha;
+    }
+};
+
+class ConstantSchedule : public LearningRateSchedule
+{
+private:
+    double m_alpha;
+
+public:
+    explicit ConstantSchedule(double alpha) : m_alpha(alpha){}
+
+    double rate(unsigned int, double)
+    {
+        return m_alpha;
+    }
+};
+
+// alpha * drop^floor(epoch / epochs_per_drop)
+class StepDecaySchedule : public LearningRateSchedule
+{
+private:
+    double m_alpha;
+    double m_drop;
+    unsigned int m_epochs_per_drop;
+
+public:
+    explicit StepDecaySchedule(double alpha, double drop, unsigned int epochs_per_drop)
+        : m_alpha(alpha), m_drop(drop), m_epochs_per_drop(std::max(1u, epochs_per_drop)){}
+
+    double rate(unsigned int epoch, double)
+    {
+        return m_alpha * std::pow(m_drop, (double)(epoch / m_epochs_per_drop));
+    }
+};
+
+// Cosine annealing from alpha to min_alpha over period epochs, with restarts
+class CosineSchedule : public LearningRateSchedule
+{
+private:
+    double m_alpha;
+    double m_min_alpha;
+    unsigned int m_period;
+
+public:
+    explicit CosineSchedule(double alpha, double min_alpha, unsigned int period)
+        : m_alpha(alpha), m_min_alpha(min_alpha), m_period(std::max(1u, period)){}
+
+    double rate(unsigned int epoch, double)
+    {
+        const double pi = std::acos(-1.0);
+        double position = (double)(epoch % m_period) / m_period;
+        return m_min_alpha + 0.5 * (m_alpha - m_min_alpha) * (1.0 + std::cos(pi * position));
+    }
+};
+
+// Linear ramp up to the wrapped schedule over the first warmup_epochs
+class WarmupSchedule : public LearningRateSchedule
+{
+private:
+    std::shared_ptr<LearningRateSchedule> m_schedule;
+    unsigned int m_warmup_epochs;
+
+public:
+    explicit WarmupSchedule(std::shared_ptr<LearningRateSchedule> schedule, unsigned int warmup_epochs)
+        : m_schedule(schedule), m_warmup_epochs(warmup_epochs){}
+
+    double rate(unsigned int epoch, double current_error)
+    {
+        if(epoch < m_warmup_epochs)
+        {
+            double rate = m_schedule->rate(0, current_error);
+            return rate * (epoch + 1) / (m_warmup_epochs + 1);
+        }
+        return m_schedule->rate(epoch - m_warmup_epochs, current_error);
+    }
+};
+
+// Full batch loss and summed gradient at theta, computed in one pass
+typedef std::function<double(const std::vector<double>& theta,
+                             std::vector<double>& gradient)> BatchEvaluation;
+
+// Step selection for full batch descent. Every strategy returns the loss and
+// gradient at the accepted theta, so the next iteration needs no extra pass.
+class BatchStepSize
+{
+public:
+    virtual ~BatchStepSize(){}
+
+    virtual void step(const std::vector<double>& theta,
+                      const std::vector<double>& gradient,
+                      double current_error,
+                      BatchEvaluation evaluate,
+                      std::vector<double>& new_theta,
+                      std::vector<double>& new_gradient,
+                      double& new_error) = 0;
+
+    // True when the last step found no decrease and left theta unchanged,
+    // so the loop should stop
+    virtual bool stalled() const
+    {
+        return false;
+    }
+
+protected:
+    static void _take_step(const std::vector<double>& theta,
+                           const std::vector<double>& gradient,
+                           double t,
+                           std::vector<double>& new_theta)
+    {
+        new_theta.resize(theta.size());
+        for(unsigned int j = 0; j < theta.size(); j++)
+        {
+            new_theta[j] = theta[j] - t * gradient[j];
+        }
+    }
+
+    static double _dot(const std::vector<double>& a, const std::vector<double>& b)
+    {
+        double sum = 0.0;
+        for(unsigned int j = 0; j < a.size(); j++)
+        {
+            sum += a[j] * b[j];
+        }
+        return sum;
+    }
+};
+
+// Steepest descent with the step taken from an epoch schedule
+class ScheduledBatchStep : public BatchStepSize
+{
+private:
+    std::shared_ptr<LearningRateSchedule> m_schedule;
+    unsigned int m_epoch = 0;
+
+public:
+    explicit ScheduledBatchStep(std::shared_ptr<LearningRateSchedule> schedule) : m_schedule(schedule){}
+
+    void step(const std::vector<double>& theta,
+              const std::vector<double>& gradient,
+              double current_error,
+              BatchEvaluation evaluate,
+              std::vector<double>& new_theta,
+              std::vector<double>& new_gradient,
+              double& new_error)
+    {
+        _take_step(theta, gradient, m_schedule->rate(m_epoch++, current_error), new_theta);
+        new_error = evaluate(new_theta, new_gradient);
+    }
+};
+
+// Backtracking until the Armijo sufficient decrease condition holds:
+//   f(theta - t g) <= f(theta) - c t |g|^2
+// Each trial is a full loss and gradient pass, so the accepted trial is reused
+// and only rejected trials cost extra passes over the data. If no trial meets
+// the condition, the trial with the lowest error below f(theta) is taken, and
+// failing that a zero step, reported by stalled().
+class ArmijoLineSearch : public BatchStepSize
+{
+private:
+    double m_t;
+    double m_c;
+    double m_beta;
+    bool m_stalled = false;
+
+    // Give up shrinking after this many trials
+    static const unsigned int max_trials = 50;
+
+public:
+    explicit ArmijoLineSearch(double initial_step, double c, double beta)
+        : m_t(initial_step), m_c(c), m_beta(beta){}
+
+    void step(const std::vector<double>& theta,
+              const std::vector<double>& gradient,
+              double current_error,
+              BatchEvaluation evaluate,
+              std::vector<double>& new_theta,
+              std::vector<double>& new_gradient,
+              double& new_error)
+    {
+        double gradient_norm_sq = _dot(gradient, gradient);
+
+        // Lowest error below the current one among the rejected trials
+        double best_t = 0.0;
+        double best_error = current_error;
+        std::vector<double> best_theta = theta;
+        std::vector<double> best_gradient = gradient;
+
+        // Start slightly above the last accepted step so it can grow again
+        double t = m_t / m_beta;
+        for(unsigned int trial = 0; trial < max_trials; trial++)
+        {
+            _take_step(theta, gradient, t, new_theta);
+            new_error = evaluate(new_theta, new_gradient);
+            if(new_error <= current_error - m_c * t * gradient_norm_sq)
+            {
+                m_t = t;
+                m_stalled = false;
+                return;
+            }
+            if(new_error < best_error)
+            {
+                best_t = t;
+                best_error = new_error;
+                best_theta = new_theta;
+                best_gradient = new_gradient;
+            }
+            t *= m_beta;
+        }
+
+        new_theta = best_theta;
+        new_gradient = best_gradient;
+        new_error = best_error;
+        m_stalled = (best_t == 0.0);
+        if(!m_stalled)
+        {
+            m_t = best_t;
+        }
+    }
+
+    bool stalled() const
+    {
+        return m_stalled;
+    }
+};
+
+// Barzilai-Borwein step t = s.s / s.y, s = theta_k - theta_k-1 and
+// y = g_k - g_k-1. Non-monotone, falls back to the previous step when the
+// curvature estimate is not positive.
+class BarzilaiBorweinStep : public BatchStepSize
+{
+private:
+    double m_t;
+    std::vector<double> m_previous_theta;
+    std::vector<double> m_previous_gradient;
+
+public:
+    explicit BarzilaiBorweinStep(double initial_step) : m_t(initial_step){}
+
+    void step(const std::vector<double>& theta,
+              const std::vector<double>& gradient,
+              double,
+              BatchEvaluation evaluate,
+              std::vector<double>& new_theta,
+              std::vector<double>& new_gradient,
+              double& new_error)
+    {
+        if(!m_previous_theta.empty())
+        {
+            std::vector<double> s(theta.size());
+            std::vector<double> y(theta.size());
+            for(unsigned int j = 0; j < theta.size(); j++)
+            {
+                s[j] = theta[j] - m_previous_theta[j];
+                y[j] = gradient[j] - m_previous_gradient[j];
+            }
+            double sy = _dot(s, y);
+            if(sy > 0.0)
+            {
+                m_t = _dot(s, s) / sy;
+            }
+        }
+        m_previous_theta = theta;
+        m_previous_gradient = gradient;
+
+        _take_step(theta, gradient, m_t, new_theta);
+        new_error = evaluate(new_theta, new_gradient);
+    }
+};
+
+// Builds the strategies from optimisation.grad.step and its settings
+class StepSizeFactory
+{
+public:
+
+    // adaptive (default) | constant | step_decay | cosine, optionally wrapped
+    // in a warmup when optimisation.grad.warmup_epochs is set
+    static std::shared_ptr<LearningRateSchedule> make_schedule(std::shared_ptr<ConfigParameters> params,
+                                                               double alpha,
+                                                               double adaptive_learning_rate)
+    {
+        std::string name = "adaptive";
+        if(params != nullptr && params->has("optimisation.grad.step"))
+        {
+            name = params->getString("optimisation.grad.step");
+        }
+
+        std::shared_ptr<LearningRateSchedule> schedule;
+        if(name == "adaptive")
+        {
+            schedule = std::make_shared<AdaptiveSchedule>(alpha, adaptive_learning_rate);
+        }
+        else if(name == "constant")
+        {
+            schedule = std::make_shared<ConstantSchedule>(alpha);
+        }
+        else if(name == "step_decay")
+        {
+            schedule = std::make_shared<StepDecaySchedule>(alpha,
+                params->get<double>("optimisation.grad.step_decay_rate"),
+                params->get<unsigned int>("optimisation.grad.step_decay_epochs"));
+        }
+        else if(name == "cosine")
+        {
+            schedule = std::make_shared<CosineSchedule>(alpha,
+                params->get<double>("optimisation.grad.cosine_min_alpha"),
+                params->get<unsigned int>("optimisation.grad.cosine_period"));
+        }
+        else
+        {
+            throw "unknown learning rate schedule: " + name;
+        }
+
+        if(params != nullptr && params->has("optimisation.grad.warmup_epochs"))
+        {
+            schedule = std::make_shared<WarmupSchedule>(schedule,
+                params->get<unsigned int>("optimisation.grad.warmup_epochs"));
+        }
+        return schedule;
+    }
+
+    // Schedules for svrg and saga. Their linear convergence needs a step
+    // bounded by the row smoothness, so the default is constant and adaptive,
+    // which keeps growing alpha while the error falls, is refused.
+    static std::shared_ptr<LearningRateSchedule> make_variance_reduced_schedule(
+        std::shared_ptr<ConfigParameters> params, double alpha)
+    {
+        if(params == nullptr || !params->has("optimisation.grad.step"))
+        {
+            return std::make_shared<ConstantSchedule>(alpha);
+        }
+        if(params->getString("optimisation.grad.step") == "adaptive")
+        {
+            throw std::string("optimisation.grad.step:adaptive is not supported by svrg/ saga, "
+                              "use constant, step_decay or cosine");
+        }
+        return make_schedule(params, alpha, 0.0);
+    }
+
+    // armijo | bb, anything else is steepest descent on a schedule
+    static std::shared_ptr<BatchStepSize> make_batch_step(std::shared_ptr<ConfigParameters> params,
+                                                          double alpha,
+                                                          double adaptive_learning_rate)
+    {
+        std::string name = "adaptive";
+        if(params != nullptr && params->has("optimisation.grad.step"))
+        {
+            name = params->getString("optimisation.grad.step");
+        }
+
+        if(name == "armijo")
+        {
+            double c = 1e-4;
+            double beta = 0.5;
+            if(params->has("optimisation.grad.armijo_c"))
+            {
+                c = params->get<double>("optimisation.grad.armijo_c");
+            }
+            if(params->has("optimisation.grad.armijo_beta"))
+            {
+                beta = params->get<double>("optimisation.grad.armijo_beta");
+            }
+            return std::make_shared<ArmijoLineSearch>(alpha, c, beta);
+        }
+        if(name == "bb")
+        {
+            return std::make_shared<BarzilaiBorweinStep>(alpha);
+        }
+        return std::make_shared<ScheduledBatchStep>(make_schedule(params, alpha, adaptive_learning_rate));
+    }
+};
+
+#endif
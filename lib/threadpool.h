@@ -0,0 +1,92 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <algorithm>
+
+// Fixed set of worker threads running submitted tasks in FIFO order
+class ThreadPool
+{
+private:
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping = false;
+
+    void _work()
+    {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+                if(m_tasks.empty())
+                {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    // Defaults to one thread per core
+    explicit ThreadPool(unsigned int threads = 0)
+    {
+        if(threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for(unsigned int i = 0; i < threads; i++)
+        {
+            m_workers.push_back(std::thread([this]() { this->_work(); }));
+        }
+    }
+
+    // Runs the queued tasks, then joins the workers
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_condition.notify_all();
+        for(auto&& worker: m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    unsigned int size() const
+    {
+        return m_workers.size();
+    }
+
+    // Queue a task, exceptions thrown by it are rethrown from the future
+    template<class Task>
+    auto submit(Task task) -> std::future<decltype(task())>
+    {
+        typedef decltype(task()) Result;
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(task);
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push([packaged]() { (*packaged)(); });
+        }
+        m_condition.notify_one();
+        return result;
+    }
+};
+
+#endif
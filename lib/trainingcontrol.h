@@ -0,0 +1,201 @@
+#ifndef TRAINING_CONTROL_H
+#define TRAINING_CONTROL_H
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <limits>
+
+// input parameters
+#include "parameter.hh"
+
+// Why a training run stopped
+enum class StopReason
+{
+    running,
+    converged,
+    max_iterations,
+    time_budget,
+    cancelled,
+    stalled
+};
+
+inline std::string to_string(StopReason reason)
+{
+    switch(reason)
+    {
+        case StopReason::running: return "running";
+        case StopReason::converged: return "converged";
+        case StopReason::max_iterations: return "max iterations";
+        case StopReason::time_budget: return "time budget";
+        case StopReason::cancelled: return "cancelled";
+        case StopReason::stalled: return "stalled";
+    }
+    return "unknown";
+}
+
+// Shared flag, set from any thread to stop a run at its next check
+class CancellationToken
+{
+private:
+    std::atomic<bool> m_cancelled;
+
+public:
+    explicit CancellationToken() : m_cancelled(false){}
+
+    void cancel()
+    {
+        m_cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    bool is_cancelled() const
+    {
+        return m_cancelled.load(std::memory_order_relaxed);
+    }
+};
+
+// Snapshot passed to the progress callback
+struct TrainingProgress
+{
+    unsigned int iteration;
+    double error;
+    double elapsed_seconds;
+    const std::vector<double>& theta;
+};
+
+// Iteration/ wall-clock budgets, cancellation and progress reporting for a
+// training loop. The loop calls should_stop() once per iteration and
+// is_cancelled() at cheap points inside long iterations.
+class TrainingControl
+{
+private:
+    typedef std::chrono::steady_clock clock;
+
+    unsigned int m_max_iterations = std::numeric_limits<unsigned int>::max();
+    double m_max_seconds = std::numeric_limits<double>::infinity();
+    std::shared_ptr<CancellationToken> m_token = std::make_shared<CancellationToken>();
+    std::function<void(const TrainingProgress&)> m_callback;
+    unsigned int m_progress_modulo = 1;
+
+    clock::time_point m_start;
+
+    // Written by the training thread, read from others through stop_reason()
+    std::atomic<StopReason> m_reason{StopReason::running};
+
+public:
+
+    // optimisation.grad.max_iterations, optimisation.grad.max_seconds and
+    // optimisation.progress_modulo, each optional
+    void add_params(std::shared_ptr<ConfigParameters> params)
+    {
+        if(params == nullptr)
+        {
+            return;
+        }
+        if(params->has("optimisation.grad.max_iterations"))
+        {
+            m_max_iterations = params->get<unsigned int>("optimisation.grad.max_iterations");
+        }
+        if(params->has("optimisation.grad.max_seconds"))
+        {
+            m_max_seconds = params->get<double>("optimisation.grad.max_seconds");
+        }
+        if(params->has("optimisation.progress_modulo"))
+        {
+            m_progress_modulo = params->get<unsigned int>("optimisation.progress_modulo");
+        }
+    }
+
+    void set_budget(unsigned int max_iterations, double max_seconds)
+    {
+        m_max_iterations = max_iterations;
+        m_max_seconds = max_seconds;
+    }
+
+    void set_cancellation_token(std::shared_ptr<CancellationToken> token)
+    {
+        m_token = token;
+    }
+
+    std::shared_ptr<CancellationToken> cancellation_token() const
+    {
+        return m_token;
+    }
+
+    void set_progress_callback(std::function<void(const TrainingProgress&)> callback,
+                               unsigned int every_n_iterations)
+    {
+        m_callback = callback;
+        m_progress_modulo = (every_n_iterations == 0) ? 1 : every_n_iterations;
+    }
+
+    // Called when the loop starts
+    void start()
+    {
+        m_start = clock::now();
+        m_reason = StopReason::running;
+    }
+
+    double elapsed_seconds() const
+    {
+        return std::chrono::duration<double>(clock::now() - m_start).count();
+    }
+
+    bool is_cancelled() const
+    {
+        return m_token->is_cancelled();
+    }
+
+    // Whether the loop should stop before starting iteration number_of_iterations
+    bool should_stop(unsigned int number_of_iterations)
+    {
+        if(m_reason != StopReason::running)
+        {
+            return true;
+        }
+        if(this->is_cancelled())
+        {
+            m_reason = StopReason::cancelled;
+        }
+        else if(number_of_iterations >= m_max_iterations)
+        {
+            m_reason = StopReason::max_iterations;
+        }
+        else if(m_max_seconds != std::numeric_limits<double>::infinity() &&
+                this->elapsed_seconds() >= m_max_seconds)
+        {
+            m_reason = StopReason::time_budget;
+        }
+        return m_reason != StopReason::running;
+    }
+
+    void converged()
+    {
+        m_reason = StopReason::converged;
+    }
+
+    // The step strategy could not decrease the error
+    void stalled()
+    {
+        m_reason = StopReason::stalled;
+    }
+
+    StopReason stop_reason() const
+    {
+        return m_reason;
+    }
+
+    void report(unsigned int iteration, double error, const std::vector<double>& theta)
+    {
+        if(m_callback && iteration % m_progress_modulo == 0)
+        {
+            TrainingProgress progress = { iteration, error, this->elapsed_seconds(), theta };
+            m_callback(progress);
+        }
+    }
+};
+
+#endif
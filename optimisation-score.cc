@@ -0,0 +1,93 @@
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <chrono>
+
+#include "lib/parameter.hh"
+#include "lib/scoring.h"
+
+
+// Scores a file of raw features with a trained model (see optimisation-test.cc)
+//
+// Parameters:
+//   scoring.model         model file written by ModelFile::save
+//   scoring.input         rows of raw features (without the intercept column)
+//   scoring.output        one prediction per row
+//   scoring.input_format  text | binary (optional, default text)
+//   scoring.output_format text | binary (optional, default text)
+//   scoring.threads       worker threads (optional, default all cores)
+int main(int argc, char **argv )
+{
+    if(argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " <parameter file> [key:value ...]" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        ConfigParameters parameters( argv[1] );
+        for( int i = 2; i < argc; ++i )
+        {
+            parameters.add( argv[ i ] );
+        }
+
+        // Optional keys
+        auto get_or = [&parameters](const std::string& key, const std::string& fallback)
+        {
+            try
+            {
+                return parameters.getString(key);
+            }
+            catch( const std::string& )
+            {
+                return fallback;
+            }
+        };
+
+        bool binary_input = get_or("scoring.input_format", "text") == "binary";
+        bool binary_output = get_or("scoring.output_format", "text") == "binary";
+        unsigned int threads = std::stoul(get_or("scoring.threads", "0"));
+
+        std::pair<double, double> minMaxPair;
+        std::vector<double> theta = ModelFile::load(parameters.getString("scoring.model"), minMaxPair);
+        BatchScorer scorer(theta, minMaxPair, threads);
+
+        std::ifstream input(parameters.getString("scoring.input").c_str(), std::ios::binary);
+        if(!input.is_open())
+        {
+            std::cout << "Input file not opened." << std::endl;
+            return 1;
+        }
+        std::ofstream output(parameters.getString("scoring.output").c_str(), std::ios::binary);
+        if(!output.is_open())
+        {
+            std::cout << "Output file not opened." << std::endl;
+            return 1;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t rows = scorer.score_stream(input, output, binary_input, binary_output);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "Scored " << rows << " rows in " << seconds << "s ("
+                  << (rows / std::max(seconds, 1e-9)) << " rows/s)" << std::endl;
+    }
+    catch( const std::string& e )
+    {
+        std::cout << "Exception: " << e << std::endl;
+        return 1;
+    }
+    catch( const char* e )
+    {
+        std::cout << "Exception: " << e << std::endl;
+        return 1;
+    }
+    catch( std::exception& e )
+    {
+        std::cerr << "exception caught: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}// end main
@@ -4,7 +4,10 @@
 
 #include "lib/datapoint.h"
 #include "lib/gradient.h"
+#include "lib/distributedgradient.h"
 #include "lib/normalisation.h"
+#include "lib/scoring.h"
+#include "lib/deduplication.h"
 
 
 using namespace std;
@@ -21,10 +24,56 @@ std::ostream& operator<<(std::ostream& os, DataPoint& data_point)
     return os;
 }
 
+// Runs DistributedGradientDescent. With optimisation.dist.check:1 the run is
+// repeated on one worker to report the scaling efficiency T1/ (N TN) and, in
+// sync mode, checked against single process batch GradientDescent, which it
+// must match exactly. Returns false if the check fails.
+bool run_distributed(std::vector<DataPoint>& training_examples,
+                     std::vector<double>& initial_theta,
+                     std::pair<double, double> minMaxPair,
+                     std::shared_ptr<ConfigParameters> params,
+                     std::vector<double>& theta)
+{
+    DistributedGradientDescent distributed(training_examples, initial_theta, minMaxPair, params);
+    theta = distributed.run();
+    if(!params->has("optimisation.dist.check") || params->get<int>("optimisation.dist.check") == 0)
+    {
+        return true;
+    }
+
+    std::shared_ptr<ConfigParameters> single_params = std::make_shared<ConfigParameters>(*params);
+    single_params->set("optimisation.dist.workers", "1");
+    DistributedGradientDescent single(training_examples, initial_theta, minMaxPair, single_params);
+    single.run();
+    std::cout << "Scaling efficiency T1/ (N TN): " << distributed.scaling_efficiency(single.seconds()) << std::endl;
+    if(distributed.bounded())
+    {
+        return true;
+    }
+
+    std::shared_ptr<ConfigParameters> batch_params = std::make_shared<ConfigParameters>(*params);
+    batch_params->set("optimisation.grad.mode", "batch");
+    GradientDescent reference(training_examples, initial_theta, minMaxPair, batch_params);
+    bool matches = (reference.run() == theta);
+    std::cout << "Sync mode " << (matches ? "matches" : "differs from")
+              << " single process batch GradientDescent" << std::endl;
+    return matches;
+}
+
 // Runs an implementation of multiple linear regression, using the gradient descent
 // implementation
 int main(int argc, char **argv )
 {
+    // Collapse duplicate rows into weighted rows (optimisation.deduplicate:1)
+    bool deduplicate = false;
+
+    // Save the model for optimisation-score (optimisation.model_file:<path>)
+    std::string model_file;
+
+    // Train over forked worker processes instead (optimisation.dist.workers)
+    std::shared_ptr<ConfigParameters> params;
+    bool distributed = false;
+
     try
     {
         // Get the config params
@@ -34,7 +83,14 @@ int main(int argc, char **argv )
             parameters.add( argv[ i ] );
         }  
 
-        std::shared_ptr<ConfigParameters> params = std::make_shared<ConfigParameters>(parameters);
+        params = std::make_shared<ConfigParameters>(parameters);
+        deduplicate = params->has("optimisation.deduplicate") &&
+                      params->get<int>("optimisation.deduplicate") != 0;
+        distributed = params->has("optimisation.dist.workers");
+        if (params->has("optimisation.model_file"))
+        {
+            model_file = params->getString("optimisation.model_file");
+        }
     }
     catch( const std::string& e )
     {
@@ -95,6 +151,12 @@ int main(int argc, char **argv )
     }
     file.close();
 
+    if (deduplicate)
+    {
+        size_t removed = Deduplication::collapse(examples);
+        std::cout << "Collapsed " << removed << " duplicate rows, " << examples.size() << " remain" << std::endl;
+    }
+
     // Print each example
     for (unsigned int i = 0; i < examples.size(); i++)
     {
@@ -109,10 +171,29 @@ int main(int argc, char **argv )
     std::vector<DataPoint> normalised_training_examples = Normalisation::normaliseAllData(
         examples, minMaxPair.first, minMaxPair.second);
     
-    // Run the SGD algorithm
-    GradientDescent grad(normalised_training_examples, intial_theta, minMaxPair);
-    grad.printData();
-    std::vector<double> theta = grad.run();
+    std::vector<double> theta;
+    if (distributed)
+    {
+        try
+        {
+            if (!run_distributed(normalised_training_examples, intial_theta, minMaxPair, params, theta))
+            {
+                return 1;
+            }
+        }
+        catch( const std::string& e )
+        {
+            std::cout << "Exception: " << e << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        // Run the SGD algorithm
+        GradientDescent grad(normalised_training_examples, intial_theta, minMaxPair);
+        grad.printData();
+        theta = grad.run();
+    }
 
     // Print the results
     std::cout << std::endl;
@@ -122,6 +203,21 @@ int main(int argc, char **argv )
     }
     std::cout << std::endl;
 
+    // Save the model for optimisation-score
+    if (!model_file.empty())
+    {
+        try
+        {
+            ModelFile::save(model_file, theta, minMaxPair);
+        }
+        catch( const std::string& e )
+        {
+            std::cout << "Exception: " << e << std::endl;
+            return 1;
+        }
+        std::cout << "Model saved to " << model_file << std::endl;
+    }
+
     return 0;
 }// end main
 
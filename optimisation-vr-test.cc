@@ -0,0 +1,85 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cmath>
+
+#include "lib/datapoint.h"
+#include "lib/gradient.h"
+#include "lib/normalisation.h"
+
+
+// Checks that the variance-reduced modes (optimisation.grad.mode:svrg and
+// saga) converge on ./lib/data.txt with the base gradient descent settings
+// and no optimisation.grad.step, i.e. their default constant step.
+// Returns non-zero if either mode fails to converge.
+int main()
+{
+    unsigned int number_of_data_points = 0;
+    unsigned int number_of_features = 0;
+    std::vector<DataPoint> examples;
+    std::ifstream file;
+
+    file.open("./lib/data.txt");
+    if (!file.is_open())
+    {
+        std::cout << "File not opened." << std::endl;
+        return 1;
+    }
+    file >> number_of_data_points >> number_of_features;
+    for (unsigned int i = 0; i < number_of_data_points; i++)
+    {
+        // Add in the features (plus extra column for intercept feature)
+        std::vector<double> feat(number_of_features+1, 1);
+        for (unsigned int j = 0; j < number_of_features; j++)
+        {
+            file >> feat[j+1];
+        }
+        std::vector<double> target(1,0);
+        file >> target[0];
+        DataPoint data_point(feat, target);
+        examples.push_back(data_point);
+    }
+    file.close();
+
+    std::pair<double, double> minMaxPair = Normalisation::getMinMaxFromAllData(examples);
+    std::vector<DataPoint> normalised_training_examples = Normalisation::normaliseAllData(
+        examples, minMaxPair.first, minMaxPair.second);
+
+    bool all_converged = true;
+    for (auto mode: {"svrg", "saga"})
+    {
+        // The values GradientDescent uses when no parameters are passed
+        std::shared_ptr<ConfigParameters> params = std::make_shared<ConfigParameters>();
+        params->set("mesh.a", "1");
+        params->set("optimisation.grad.alpha", "0.01");
+        params->set("optimisation.grad.eps", "0.00001");
+        params->set("optimisation.grad.adaptive_learning_rate", "0.05");
+        params->set("optimisation.grad.momentum_gamma", "0.9");
+        params->set("optimisation.grad.acceptable_error", "0.00001");
+        params->set("optimisation.grad.theta_convergence", "0.01");
+        params->set("optimisation.log_err_modulo", "1");
+        params->set("optimisation.print_err_modulo", "1000");
+        params->set("optimisation.grad.max_iterations", "100000");
+        params->set("optimisation.grad.mode", mode);
+
+        std::vector<double> initial_theta(number_of_features+1, 1.0);
+        GradientDescent grad(normalised_training_examples, initial_theta, minMaxPair, params);
+        std::vector<double> theta = grad.run();
+
+        bool finite = true;
+        for (auto value: theta)
+        {
+            finite = finite && std::isfinite(value);
+        }
+        bool converged = finite && grad.stop_reason() == StopReason::converged;
+        all_converged = all_converged && converged;
+
+        std::cout << mode << ": " << to_string(grad.stop_reason()) << ",";
+        for (unsigned int i = 0; i < theta.size(); i++)
+        {
+            std::cout << " Theta_" << i << ": " << theta[i];
+        }
+        std::cout << (converged ? " - ok" : " - FAILED") << std::endl;
+    }
+    return all_converged ? 0 : 1;
+}